@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// cache line size assumed by every padded or aligned structure in the tables
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// allocator that hands out storage aligned to a cache line (or a larger power of two),
+// so a std::vector of slots or buckets never starts in the middle of a line. it over-allocates
+// with the plain operator new and aligns by hand, because libitm only provides transactional
+// clones of the plain operator new and delete, not of the aligned ones
+template <class T, std::size_t Align = CACHE_LINE_SIZE>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Align>;
+    };
+
+    AlignedAllocator() noexcept {}
+
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        char* raw = static_cast<char*>(::operator new(n * sizeof(T) + Align + sizeof(void*)));
+        char* aligned = raw + sizeof(void*);
+        aligned += (Align - reinterpret_cast<std::uintptr_t>(aligned) % Align) % Align;
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Align>&) const noexcept { return true; }
+
+    template <class U>
+    bool operator!=(const AlignedAllocator<U, Align>&) const noexcept { return false; }
+};
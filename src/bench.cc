@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <climits>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <memory>
+
+#include "sequential.h"
+#include "concurrent.h"
+#include "filtered_set.h"
+#include "lock_free.h"
+#include "trace.h"
+#include "transactional.h"
+#include "workload.h"
+
+// benchmark driver: runs a configurable operation mix on real threads against one of the
+// sets and reports throughput, sampled per-operation latency percentiles and the size check.
+// the operations are generated before timing (see workload.h) or replayed from a trace
+// mapped in place (see trace.h). run with --help for the options
+
+struct Config : Workload {
+    std::string impl = "concurrent";  // sequential, concurrent, filtered, lockfree or transactional
+    std::vector<int> threads = {1, 2, 4, 8};
+    int capacity = 12000;
+    int sample_every = 64;            // one latency sample every this many operations
+    bool pin = true;                  // pin thread i to core i % cores
+    unsigned abort_limit = 0;         // transactional only, see TransactionalCuckooSet
+    bool combining = false;           // concurrent only, writes go through a combiner
+    std::string csv;                  // append one row per run to this file
+    std::string stats_csv;            // append the counters of each run to this file (make STATS=1)
+    std::string trace;                // replay this trace instead of the generated workload
+    const TraceFile* replay = nullptr; // the trace once main has mapped it
+};
+
+// records one thread replays, generated or straight from the mapping of a trace
+struct OperationStream {
+    const uint32_t* records;
+    size_t count;
+};
+
+struct ThreadResult {
+    long long delta = 0;             // successful adds minus successful removes
+    long long hits = 0;              // successful contains, kept so the lookups cannot be optimized away
+    std::vector<uint32_t> latencies; // sampled operation latencies in nanoseconds
+};
+
+struct RunResult {
+    long long elapsed_ns = 0;
+    long long total_ops = 0;
+    std::vector<uint32_t> latencies;
+    bool size_ok = true;
+    int size = 0;
+    long long expected_size = 0;
+    CuckooStats stats;
+};
+
+// spin barrier that releases every thread at once, so none starts before the others are ready
+class StartBarrier {
+    std::atomic<int> waiting;
+    std::atomic<bool> released{false};
+
+public:
+    explicit StartBarrier(int count) : waiting(count) {}
+
+    void arrive_and_wait() {
+        waiting.fetch_sub(1, std::memory_order_acq_rel);
+        while (!released.load(std::memory_order_acquire)) {
+            cpu_relax();
+        }
+    }
+
+    // function for the coordinator to wait for every thread, then release them all
+    void release_when_ready() {
+        while (waiting.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+        released.store(true, std::memory_order_release);
+    }
+};
+
+void usage() {
+    std::cout << "usage: bench [options]\n"
+              << "  --impl NAME         sequential, concurrent, filtered, lockfree or transactional\n"
+              << "                      (default concurrent)\n"
+              << "  --threads LIST      comma separated thread counts (default 1,2,4,8)\n"
+              << "  --capacity N        initial capacity of the set (default 12000)\n"
+              << WORKLOAD_USAGE
+              << "  --trace FILE        replay a trace (see trace_gen) instead of the workload options\n"
+              << "  --sample-every N    latency sample rate (default 64)\n"
+              << "  --no-pin            do not pin threads to cores\n"
+              << "  --combining         concurrent: apply adds and removes through one combiner\n"
+              << "  --abort-limit N     transactional fallback after N aborts (default 0, never)\n"
+              << "  --csv FILE          append NUM_OPS,CAPACITY,KEY_MAX,INITIAL_SIZE,NUM_THREADS,time rows\n"
+              << "  --stats-csv FILE    append the hot-path counters of each run (needs make STATS=1)\n";
+}
+
+bool parse_args(int argc, char *argv[], Config& config) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool valid = true;
+        int value_at = i + 1; // the value of arg, if it takes one
+        try {
+            if (arg == "--help" || arg == "-h") {
+                return false;
+            } else if (arg == "--no-pin") {
+                config.pin = false;
+            } else if (arg == "--combining") {
+                config.combining = true;
+            } else if (!has_value) {
+                std::cerr << "missing value for " << arg << std::endl;
+                return false;
+            } else if (parse_workload_option(arg, argv[i + 1], config, valid)) {
+                i++;
+            } else if (arg == "--impl") {
+                config.impl = argv[++i];
+            } else if (arg == "--threads") {
+                config.threads = parse_list(argv[++i]);
+                if (config.threads.empty() || *std::min_element(config.threads.begin(), config.threads.end()) < 1) {
+                    std::cerr << "--threads needs thread counts of at least 1" << std::endl;
+                    valid = false;
+                }
+            } else if (arg == "--capacity") {
+                config.capacity = static_cast<int>(parse_integer(argv[++i], 1, INT_MAX));
+            } else if (arg == "--sample-every") {
+                config.sample_every = static_cast<int>(parse_integer(argv[++i], 1, INT_MAX));
+            } else if (arg == "--trace") {
+                config.trace = argv[++i];
+            } else if (arg == "--abort-limit") {
+                config.abort_limit = static_cast<unsigned>(parse_integer(argv[++i], 0, UINT_MAX));
+            } else if (arg == "--csv") {
+                config.csv = argv[++i];
+            } else if (arg == "--stats-csv") {
+                config.stats_csv = argv[++i];
+            } else {
+                std::cerr << "unknown option " << arg << std::endl;
+                return false;
+            }
+        } catch (const std::logic_error&) { // std::invalid_argument or std::out_of_range
+            std::cerr << "invalid value " << argv[value_at] << " for " << arg << std::endl;
+            return false;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    return finish_workload(config);
+}
+
+// function to get the records a thread replays from a trace: stream thread_id % streams, or
+// an equal share of a trace of a single stream
+OperationStream trace_stream(const TraceFile& trace, int thread_id, int num_threads) {
+    if (trace.streams() == 1) {
+        size_t size = trace.stream_size(0);
+        size_t first = size * thread_id / num_threads;
+        size_t last = size * (thread_id + 1) / num_threads;
+        return OperationStream{trace.stream(0) + first, last - first};
+    }
+    int stream = thread_id % trace.streams();
+    return OperationStream{trace.stream(stream), trace.stream_size(stream)};
+}
+
+// function to get the distinct keys a trace preloads
+std::vector<int> trace_entries(const TraceFile& trace) {
+    std::unordered_set<int> entries;
+    for (size_t i = 0; i < trace.preload_size(); i++) {
+        entries.insert(static_cast<int>(trace_key(trace.preload()[i])));
+    }
+    return {entries.begin(), entries.end()};
+}
+
+void pin_to_core(int thread_id) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(thread_id % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+template <class Set>
+void run_operations(Set& set, OperationStream ops, int sample_every, ThreadResult& result) {
+    result.latencies.reserve(ops.count / sample_every + 1);
+    for (size_t i = 0; i < ops.count; i++) {
+        uint32_t record = ops.records[i];
+        int val = static_cast<int>(trace_key(record));
+        bool sampled = i % sample_every == 0;
+        std::chrono::steady_clock::time_point start;
+        if (sampled) {
+            start = std::chrono::steady_clock::now();
+        }
+        switch (trace_op(record)) {
+            case TRACE_CONTAINS:
+                result.hits += set.contains(val);
+                break;
+            case TRACE_ADD:
+                result.delta += set.add(val);
+                break;
+            case TRACE_REMOVE:
+                result.delta -= set.remove(val);
+                break;
+        }
+        if (sampled) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            result.latencies.push_back(static_cast<uint32_t>(std::min<long long>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), UINT32_MAX)));
+        }
+    }
+}
+
+template <class Set>
+RunResult run(Set& set, const Config& config, int num_threads) {
+    std::vector<int> entries = config.replay ? trace_entries(*config.replay) : generate_entries(config);
+    set.populate(entries);
+    std::vector<std::vector<uint32_t>> generated(config.replay ? 0 : num_threads);
+    std::vector<OperationStream> ops;
+    for (int thread = 0; thread < num_threads; thread++) {
+        if (config.replay) {
+            ops.push_back(trace_stream(*config.replay, thread, num_threads));
+            continue;
+        }
+        generated[thread].reserve(config.ops);
+        generate_operations(config, thread, [&generated, thread](uint32_t record) {
+            generated[thread].push_back(record);
+        });
+        ops.push_back(OperationStream{generated[thread].data(), generated[thread].size()});
+    }
+
+    std::vector<ThreadResult> results(num_threads);
+    StartBarrier barrier(num_threads);
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < num_threads; thread++) {
+        threads.emplace_back([&, thread] {
+            if (config.pin) {
+                pin_to_core(thread);
+            }
+            barrier.arrive_and_wait();
+            run_operations(set, ops[thread], config.sample_every, results[thread]);
+        });
+    }
+    barrier.release_when_ready();
+    auto exec_time_start = std::chrono::steady_clock::now();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto exec_time_end = std::chrono::steady_clock::now();
+
+    RunResult run_result;
+    run_result.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(exec_time_end - exec_time_start).count();
+    for (const OperationStream& stream : ops) {
+        run_result.total_ops += stream.count;
+    }
+    run_result.expected_size = entries.size();
+    for (ThreadResult& result : results) {
+        run_result.expected_size += result.delta;
+        run_result.latencies.insert(run_result.latencies.end(), result.latencies.begin(), result.latencies.end());
+    }
+    run_result.size = set.size();
+    run_result.size_ok = run_result.size == run_result.expected_size;
+    run_result.stats = set.stats();
+    return run_result;
+}
+
+uint32_t percentile(std::vector<uint32_t>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(fraction * (sorted.size() - 1));
+    return sorted[index];
+}
+
+void append_csv(const Config& config, int num_threads, long long elapsed_ms) {
+    std::ifstream existing(config.csv);
+    bool empty = !existing.good() || existing.peek() == std::ifstream::traits_type::eof();
+    existing.close();
+    std::ofstream out(config.csv, std::ios::app);
+    if (empty) {
+        out << "NUM_OPS,CAPACITY,KEY_MAX,INITIAL_SIZE,NUM_THREADS,time(miliseconds)\n";
+    }
+    out << config.ops << "," << config.capacity << "," << config.key_max << "," << config.initial << ","
+        << num_threads << "," << elapsed_ms << "\n";
+}
+
+void append_stats_csv(const Config& config, int num_threads, const CuckooStats& stats) {
+    std::ifstream existing(config.stats_csv);
+    bool empty = !existing.good() || existing.peek() == std::ifstream::traits_type::eof();
+    existing.close();
+    std::ofstream out(config.stats_csv, std::ios::app);
+    if (empty) {
+        out << "IMPL,NUM_THREADS," << CuckooStats::csv_header() << "\n";
+    }
+    out << config.impl << "," << num_threads << "," << stats.to_csv() << "\n";
+}
+
+template <class Set, class Make>
+bool run_all(const Config& config, Make make_set) {
+    bool all_ok = true;
+    std::cout << "impl\tthreads\tops/sec\tp50(ns)\tp99(ns)\tp99.9(ns)\tsize\texpected" << std::endl;
+    for (int num_threads : config.threads) {
+        std::unique_ptr<Set> set(make_set());
+        RunResult result = run(*set, config, num_threads);
+        std::sort(result.latencies.begin(), result.latencies.end());
+        double ops_per_sec = result.total_ops * 1e9 / std::max<long long>(1, result.elapsed_ns);
+        std::cout << config.impl << "\t" << num_threads << "\t" << static_cast<long long>(ops_per_sec) << "\t"
+                  << percentile(result.latencies, 0.5) << "\t" << percentile(result.latencies, 0.99) << "\t"
+                  << percentile(result.latencies, 0.999) << "\t" << result.size << "\t" << result.expected_size
+                  << (result.size_ok ? "" : "\tSIZE MISMATCH") << std::endl;
+        if (CUCKOO_STATS_ENABLED) {
+            std::cout << "stats\t" << result.stats.to_json() << std::endl;
+        }
+        if (!config.csv.empty()) {
+            append_csv(config, num_threads, result.elapsed_ns / 1000000);
+        }
+        if (CUCKOO_STATS_ENABLED && !config.stats_csv.empty()) {
+            append_stats_csv(config, num_threads, result.stats);
+        }
+        all_ok = all_ok && result.size_ok;
+    }
+    return all_ok;
+}
+
+int main(int argc, char *argv[]) {
+    Config config;
+    if (!parse_args(argc, argv, config)) {
+        usage();
+        return 1;
+    }
+    TraceFile trace;
+    if (!config.trace.empty()) {
+        if (!trace.open(config.trace)) {
+            std::cerr << "cannot map a valid trace from " << config.trace << std::endl;
+            return 1;
+        }
+        config.replay = &trace;
+    }
+    bool ok;
+    if (config.impl == "sequential") {
+        if (std::any_of(config.threads.begin(), config.threads.end(), [](int n) { return n != 1; })) {
+            std::cerr << "the sequential set is not thread safe, running with 1 thread" << std::endl;
+            config.threads = {1};
+        }
+        ok = run_all<Sequential<int>>(config, [&] { return new Sequential<int>(config.capacity); });
+    } else if (config.impl == "concurrent") {
+        ok = run_all<CuckooConcurrentHashSet<int>>(config, [&] {
+            auto* set = new CuckooConcurrentHashSet<int>(config.capacity);
+            set->set_combining(config.combining);
+            return set;
+        });
+    } else if (config.impl == "filtered") {
+        ok = run_all<CuckooFilteredSet<int>>(config, [&] { return new CuckooFilteredSet<int>(config.capacity); });
+    } else if (config.impl == "lockfree") {
+        ok = run_all<LockFreeCuckooSet<int>>(config, [&] { return new LockFreeCuckooSet<int>(config.capacity); });
+    } else if (config.impl == "transactional") {
+        ok = run_all<TransactionalCuckooSet<int>>(config, [&] {
+            return new TransactionalCuckooSet<int>(config.capacity, config.abort_limit);
+        });
+    } else {
+        std::cerr << "unknown implementation " << config.impl << std::endl;
+        usage();
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
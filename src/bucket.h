@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "aligned_allocator.h"
+
+// smallest power of two that holds a bucket, capped at one cache line, so that
+// a bucket never straddles two lines when the bucket array is line aligned
+constexpr std::size_t bucket_alignment(std::size_t ways, std::size_t key_size, std::size_t key_align) {
+    std::size_t bytes = (ways + key_align - 1) / key_align * key_align + ways * key_size;
+    std::size_t align = key_align;
+    while (align < bytes && align < CACHE_LINE_SIZE) {
+        align <<= 1;
+    }
+    return align;
+}
+
+// fingerprint stored next to each key, derived from the high bits of a mixed hash.
+// 0 is reserved for empty ways so a real fingerprint is always in [1, 255]
+inline uint8_t fingerprint(std::size_t hash) {
+    uint8_t tag = static_cast<uint8_t>((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> 56);
+    return tag + (tag == 0);
+}
+
+// largest group of keys a batched operation hashes and prefetches before it probes
+constexpr int MAX_BATCH_SIZE = 64;
+constexpr int DEFAULT_BATCH_SIZE = 16;
+
+// set-associative bucket: a packed array of 8-bit fingerprints followed by the keys.
+// a probe compares the fingerprint against every way at once and only touches the
+// keys whose fingerprint matched
+template <class T, int WAYS>
+struct alignas(bucket_alignment(WAYS, sizeof(T), alignof(T))) Bucket {
+    static_assert(WAYS >= 1 && WAYS <= 16, "a bucket holds between 1 and 16 ways");
+
+    static constexpr uint8_t EMPTY = 0;
+    static constexpr uint32_t ALL_WAYS = (1u << WAYS) - 1;
+
+    uint8_t tags[WAYS] = {}; // fingerprint of each way, EMPTY if the way is free
+    T keys[WAYS];
+
+    // function returning a bitmask of the ways whose tag equals the given one
+    uint32_t match(uint8_t tag) const {
+#if defined(__SSE2__)
+        __m128i lanes;
+        if constexpr (WAYS == 16) {
+            lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags));
+        } else if constexpr (WAYS > 4) {
+            uint64_t word = 0;
+            std::memcpy(&word, tags, WAYS);
+            lanes = _mm_cvtsi64_si128(static_cast<long long>(word));
+        } else {
+            uint32_t word = 0;
+            std::memcpy(&word, tags, WAYS);
+            lanes = _mm_cvtsi32_si128(static_cast<int>(word));
+        }
+        __m128i hits = _mm_cmpeq_epi8(lanes, _mm_set1_epi8(static_cast<char>(tag)));
+        return static_cast<uint32_t>(_mm_movemask_epi8(hits)) & ALL_WAYS;
+#else
+        uint32_t mask = 0;
+        for (int way = 0; way < WAYS; way++) {
+            mask |= static_cast<uint32_t>(tags[way] == tag) << way;
+        }
+        return mask;
+#endif
+    }
+
+    // function returning a bitmask of the free ways
+    uint32_t empty_ways() const {
+        return match(EMPTY);
+    }
+
+    // function to count the occupied ways
+    int count() const {
+        return WAYS - __builtin_popcount(empty_ways());
+    }
+
+    // function to find the way holding a key, -1 if it is not in the bucket. K is T or any
+    // type T compares equal to
+    template <class K>
+    int find(uint8_t tag, const K& key) const {
+        for (uint32_t mask = match(tag); mask != 0; mask &= mask - 1) {
+            int way = __builtin_ctz(mask);
+            if (keys[way] == key) {
+                return way;
+            }
+        }
+        return -1;
+    }
+
+    // function to pull every cache line of the bucket towards the core ahead of a probe
+    void prefetch() const {
+        for (std::size_t offset = 0; offset < sizeof(Bucket); offset += CACHE_LINE_SIZE) {
+            __builtin_prefetch(reinterpret_cast<const char*>(this) + offset, 0, 3);
+        }
+    }
+
+    // function to prefetch the bucket ahead of a write, the lines arrive in exclusive state
+    void prefetch_for_write() const {
+        for (std::size_t offset = 0; offset < sizeof(Bucket); offset += CACHE_LINE_SIZE) {
+            __builtin_prefetch(reinterpret_cast<const char*>(this) + offset, 1, 3);
+        }
+    }
+
+    // function to store a key in a way that is known to be free
+    void store(int way, uint8_t tag, T&& key) {
+        keys[way] = std::move(key);
+        tags[way] = tag;
+    }
+
+    // function to move the key of a way into a free way of another bucket, freeing this way
+    void move_to(int way, Bucket& target, int target_way) {
+        target.keys[target_way] = std::move(keys[way]);
+        target.tags[target_way] = tags[way];
+        tags[way] = EMPTY;
+    }
+
+    // function to free a way, dropping whatever the key owns
+    void erase(int way) {
+        tags[way] = EMPTY;
+        keys[way] = T();
+    }
+};
+
+// array of buckets starting on a cache line: either allocated here, every bucket empty, or
+// laid over memory that outlives it (the buckets of a mapped snapshot), which it never frees
+template <class B>
+class BucketArray {
+    B* first;
+    std::size_t count;
+    bool owned;
+
+public:
+    explicit BucketArray(std::size_t count)
+            : first(AlignedAllocator<B>().allocate(count)), count(count), owned(true) {
+        for (std::size_t i = 0; i < count; i++) {
+            new (first + i) B();
+        }
+    }
+
+    BucketArray(B* external, std::size_t count) : first(external), count(count), owned(false) {}
+
+    BucketArray(const BucketArray&) = delete;
+    BucketArray& operator=(const BucketArray&) = delete;
+
+    ~BucketArray() {
+        if (owned) {
+            for (std::size_t i = 0; i < count; i++) {
+                first[i].~B();
+            }
+            AlignedAllocator<B>().deallocate(first, count);
+        }
+    }
+
+    // function to check whether the buckets were allocated here rather than laid over memory
+    bool owns() const {
+        return owned;
+    }
+
+    // function to hand the buckets over to a new array, which frees them when it is deleted.
+    // this one keeps pointing at them, for readers that reached it before, but never frees them
+    BucketArray* release() {
+        BucketArray* taken = new BucketArray(first, count);
+        taken->owned = owned;
+        owned = false;
+        return taken;
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    B& operator[](std::size_t i) {
+        return first[i];
+    }
+
+    const B& operator[](std::size_t i) const {
+        return first[i];
+    }
+
+    B* begin() {
+        return first;
+    }
+
+    B* end() {
+        return first + count;
+    }
+
+    const B* begin() const {
+        return first;
+    }
+
+    const B* end() const {
+        return first + count;
+    }
+};
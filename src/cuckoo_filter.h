@@ -0,0 +1,343 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "hash_policy.h"
+#include "lock_table.h"
+
+// function to get the fingerprint width a cuckoo filter needs for a false-positive rate: the
+// smallest even width from 4 to 16 bits whose rate (see CuckooFilter::false_positive_rate)
+// is at most the target
+constexpr int fingerprint_bits_for(double rate) {
+    int bits = 4;
+    while (bits < 16 && 8.0 / static_cast<double>(1ull << bits) > rate) {
+        bits += 2;
+    }
+    return bits;
+}
+
+// cuckoo filter (Fan et al.): approximate membership in FingerprintBits bits per slot. a key
+// is reduced to a fingerprint and stored in one of two buckets of four slots, the second
+// derived from the first and the fingerprint alone (partial-key cuckoo hashing), so a
+// fingerprint can be displaced to its other bucket without the key. contains never misses a
+// key that was added and not removed, and wrongly reports an absent key with probability
+// false_positive_rate(). remove must only be given keys that were added: it drops one
+// matching fingerprint, which may be the one of another key if the key was never added.
+//
+// a bucket is FingerprintBits / 2 bytes, so buckets never share a byte and 12-bit
+// fingerprints cost 12 bits per slot, 12 / load bits per key. the constructor sizes the
+// buckets for the 95% load four-slot buckets reach, then rounds their count up to a power
+// of two, so the expected keys fill 47.5% to 95% of the slots: 12.6 to 25.3 bits per key,
+// see memory_bytes. the bucket count never changes, an add that finds no room returns
+// false and leaves the filter as it was (CuckooFilteredSet then moves to a filter of twice
+// the slots, which starts about half full).
+//
+// LockPolicy is NoLock for a filter used by one thread at a time or StripedLock for a filter
+// shared between threads: writers lock the stripes of the buckets they change, readers
+// validate their seqlock versions. a displacement moves one fingerprint at a time between
+// its two buckets, starting from the free end of the path, so a lookup never misses a
+// fingerprint that is being moved
+template <class T, int FingerprintBits = 12, class Hash = DefaultHash<T>, class LockPolicy = NoLock>
+class CuckooFilter {
+    static_assert(FingerprintBits >= 4 && FingerprintBits <= 16 && FingerprintBits % 2 == 0,
+                  "a fingerprint has an even number of bits from 4 to 16");
+
+    static constexpr bool CONCURRENT = LockPolicy::CONCURRENT;
+    static constexpr int DEFAULT_LOCK_STRIPES = 1024;
+    static constexpr int SLOTS = 4;
+    static constexpr int BUCKET_BYTES = FingerprintBits * SLOTS / 8;
+    static constexpr uint64_t FINGERPRINT_MASK = (1ull << FingerprintBits) - 1;
+    static constexpr uint32_t EMPTY = 0;
+    // load the constructor sizes the buckets for, 4-slot buckets fill to about 95%
+    static constexpr double TARGET_LOAD = 0.95;
+    // fingerprints a displacement moves at most before the filter counts as full
+    static constexpr int MAX_KICKS = 500;
+    // displacement paths an add tries when writers keep invalidating them
+    static constexpr int MAX_PATH_ATTEMPTS = 4;
+
+    template <class U>
+    using Shared = typename LockPolicy::template Atomic<U>;
+
+    // buckets and fingerprint of a key
+    struct Location {
+        size_t index[2];
+        uint32_t fingerprint;
+    };
+
+    // one move of a displacement path: the fingerprint in slot of bucket goes to its other
+    // bucket
+    struct Kick {
+        size_t bucket;
+        int slot;
+        uint32_t fingerprint;
+    };
+
+    size_t mask; // buckets - 1
+    std::unique_ptr<uint8_t[]> buckets;
+    LockPolicy locks;
+    // fingerprint count, one shard per stripe updated by its holder as in CuckooSet
+    struct alignas(CACHE_LINE_SIZE) CountShard {
+        Shared<int64_t> keys{0};
+    };
+    int count_shards;
+    std::unique_ptr<CountShard[]> counts;
+    Hash hasher;
+
+    // function to get the other bucket of a fingerprint: the xor with a multiplicative hash
+    // of the fingerprint, so either bucket leads to the other
+    size_t alternate(size_t index, uint32_t fingerprint) const {
+        return (index ^ (fingerprint * 0x5BD1E995ull)) & mask;
+    }
+
+    template <class K>
+    Location locate(const K& key) const {
+        uint64_t key_hash = hasher(key, INITIAL_HASH_SEED);
+        Location location;
+        uint32_t fingerprint = static_cast<uint32_t>((key_hash >> 32) & FINGERPRINT_MASK);
+        location.fingerprint = fingerprint + (fingerprint == EMPTY); // 0 marks a free slot
+        location.index[0] = hash_part(key_hash, 0) & mask;
+        location.index[1] = alternate(location.index[0], location.fingerprint);
+        return location;
+    }
+
+    // functions to read and write the slots of a bucket as one word, slot i in bits
+    // [i * FingerprintBits, (i + 1) * FingerprintBits)
+    uint64_t load_bucket(size_t index) const {
+        uint64_t word = 0;
+        std::memcpy(&word, &buckets[index * BUCKET_BYTES], BUCKET_BYTES);
+        return word;
+    }
+
+    void store_bucket(size_t index, uint64_t word) {
+        std::memcpy(&buckets[index * BUCKET_BYTES], &word, BUCKET_BYTES);
+    }
+
+    static uint32_t slot_of(uint64_t word, int slot) {
+        return static_cast<uint32_t>((word >> (slot * FingerprintBits)) & FINGERPRINT_MASK);
+    }
+
+    static uint64_t with_slot(uint64_t word, int slot, uint32_t fingerprint) {
+        int shift = slot * FingerprintBits;
+        return (word & ~(FINGERPRINT_MASK << shift)) | (static_cast<uint64_t>(fingerprint) << shift);
+    }
+
+    // function to find the slot of a bucket word holding a fingerprint, -1 if none does
+    static int find_slot(uint64_t word, uint32_t fingerprint) {
+        for (int slot = 0; slot < SLOTS; slot++) {
+            if (slot_of(word, slot) == fingerprint) {
+                return slot;
+            }
+        }
+        return -1;
+    }
+
+    // function to store a fingerprint in a free slot of a bucket, the caller holds its stripe
+    bool try_store(size_t index, uint32_t fingerprint) {
+        uint64_t word = load_bucket(index);
+        int slot = find_slot(word, EMPTY);
+        if (slot < 0) {
+            return false;
+        }
+        store_bucket(index, with_slot(word, slot, fingerprint));
+        return true;
+    }
+
+    // function to read a bucket without its lock, retrying while a writer holds its stripe
+    uint64_t read_bucket(size_t index) const {
+        size_t stripe = locks.stripe_of(index);
+        for (;;) {
+            uint64_t version = locks.read_begin(stripe);
+            uint64_t word = load_bucket(index);
+            if ((version & 1) == 0 && locks.read_validate(stripe, version)) {
+                return word;
+            }
+            cpu_relax();
+        }
+    }
+
+    void lock_buckets(size_t first, size_t second, StripeList<2>& held) {
+        held.push(locks.stripe_of(first));
+        held.push(locks.stripe_of(second));
+        locks.lock(held);
+    }
+
+    // function to change the count of the shard of a bucket index, the caller holds its stripe
+    void count_change(size_t index, int64_t delta) {
+        Shared<int64_t>& shard = counts[locks.stripe_of(index) & (count_shards - 1)].keys;
+        shard.store(shard.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    // function to find a displacement path by a random walk without locks: from one of the
+    // buckets of the new fingerprint, evict a random slot to its other bucket until a bucket
+    // with a free slot is reached. false if none is found within MAX_KICKS moves
+    bool search_path(const Location& location, uint64_t random, std::vector<Kick>& path) const {
+        path.clear();
+        size_t index = location.index[(random >> 32) & 1];
+        for (int kick = 0; kick < MAX_KICKS; kick++) {
+            random ^= random << 13; // xorshift
+            random ^= random >> 7;
+            random ^= random << 17;
+            int slot = static_cast<int>(random % SLOTS);
+            uint32_t fingerprint = slot_of(read_bucket(index), slot);
+            if (fingerprint == EMPTY) {
+                return true; // a slot of the bucket was freed meanwhile
+            }
+            path.push_back(Kick{index, slot, fingerprint});
+            index = alternate(index, fingerprint);
+            if (find_slot(read_bucket(index), EMPTY) >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // function to carry out a path from its free end: each fingerprint is copied into its
+    // other bucket and then cleared, both under the stripes of the two buckets, so it is in
+    // one of them at every point. false as soon as a move finds the path changed; the moves
+    // done until then are harmless
+    bool apply_path(const std::vector<Kick>& path) {
+        for (size_t i = path.size(); i-- > 0;) {
+            const Kick& kick = path[i];
+            size_t target = alternate(kick.bucket, kick.fingerprint);
+            StripeList<2> held;
+            lock_buckets(kick.bucket, target, held);
+            bool moved = slot_of(load_bucket(kick.bucket), kick.slot) == kick.fingerprint
+                      && try_store(target, kick.fingerprint);
+            if (moved) {
+                store_bucket(kick.bucket, with_slot(load_bucket(kick.bucket), kick.slot, EMPTY));
+            }
+            locks.unlock(held);
+            if (!moved) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // constructor sizing the buckets for expected_keys at the target load, rounded up to a
+    // power of two
+    explicit CuckooFilter(size_t expected_keys, int lock_stripes = DEFAULT_LOCK_STRIPES)
+            : locks(lock_stripes), count_shards(CONCURRENT ? locks.size() : 1), counts(new CountShard[count_shards]) {
+        size_t needed = static_cast<size_t>(std::ceil(expected_keys / (SLOTS * TARGET_LOAD)));
+        size_t bucket_count = 1;
+        while (bucket_count < needed) {
+            bucket_count <<= 1;
+        }
+        mask = bucket_count - 1;
+        buckets.reset(new uint8_t[bucket_count * BUCKET_BYTES]());
+    }
+
+    CuckooFilter(const CuckooFilter&) = delete;
+    CuckooFilter& operator=(const CuckooFilter&) = delete;
+
+    // function to add the fingerprint of a key, false if the filter is too full to take it.
+    // a key added twice has two fingerprints and needs two removes
+    template <class K>
+    bool add(const K& key) {
+        Location location = locate(key);
+        std::vector<Kick> path;
+        for (int attempt = 0; attempt < MAX_PATH_ATTEMPTS; attempt++) {
+            StripeList<2> held;
+            lock_buckets(location.index[0], location.index[1], held);
+            bool stored = try_store(location.index[0], location.fingerprint)
+                       || try_store(location.index[1], location.fingerprint);
+            if (stored) {
+                count_change(location.index[0], 1);
+            }
+            locks.unlock(held);
+            if (stored) {
+                return true;
+            }
+            uint64_t random = mix64(location.index[0] ^ location.fingerprint, attempt + 1) | 1;
+            if (!search_path(location, random, path)) {
+                return false;
+            }
+            apply_path(path); // frees a slot of the first bucket of the path unless writers interfered
+        }
+        return false;
+    }
+
+    // function to check for a key: false means it was never added (or was removed), true that
+    // it probably was
+    template <class K>
+    bool contains(const K& key) const {
+        Location location = locate(key);
+        size_t first = locks.stripe_of(location.index[0]);
+        size_t second = locks.stripe_of(location.index[1]);
+        for (;;) {
+            uint64_t first_version = locks.read_begin(first);
+            uint64_t second_version = locks.read_begin(second);
+            uint64_t first_word = load_bucket(location.index[0]); // both loads issued before either is tested
+            uint64_t second_word = load_bucket(location.index[1]);
+            bool found = find_slot(first_word, location.fingerprint) >= 0 || find_slot(second_word, location.fingerprint) >= 0;
+            if (((first_version | second_version) & 1) == 0 && locks.read_validate(first, first_version)
+                    && locks.read_validate(second, second_version)) {
+                return found;
+            }
+            cpu_relax(); // a writer held one of the stripes
+        }
+    }
+
+    // function to remove one fingerprint of a key that was added, false if none was found
+    template <class K>
+    bool remove(const K& key) {
+        Location location = locate(key);
+        StripeList<2> held;
+        lock_buckets(location.index[0], location.index[1], held);
+        bool removed = false;
+        for (size_t index : location.index) {
+            uint64_t word = load_bucket(index);
+            int slot = find_slot(word, location.fingerprint);
+            if (slot >= 0) {
+                store_bucket(index, with_slot(word, slot, EMPTY));
+                removed = true;
+                break;
+            }
+        }
+        if (removed) {
+            count_change(location.index[0], -1);
+        }
+        locks.unlock(held);
+        return removed;
+    }
+
+    // function to get the number of fingerprints, briefly off while writers run
+    size_t size() const {
+        int64_t keys = 0;
+        for (int shard = 0; shard < count_shards; shard++) {
+            keys += counts[shard].keys.load(std::memory_order_relaxed);
+        }
+        return keys < 0 ? 0 : keys;
+    }
+
+    // function to get the number of slots
+    size_t slots() const {
+        return (mask + 1) * SLOTS;
+    }
+
+    double load_factor() const {
+        return static_cast<double>(size()) / slots();
+    }
+
+    // function to get the bytes of the buckets, the lock stripes aside
+    size_t memory_bytes() const {
+        return (mask + 1) * BUCKET_BYTES;
+    }
+
+    // function to get the rate of false positives when the filter is full: a lookup compares
+    // 2 * SLOTS fingerprints, each equal by chance with probability 2^-FingerprintBits
+    static constexpr double false_positive_rate() {
+        return 2.0 * SLOTS / static_cast<double>(1ull << FingerprintBits);
+    }
+};
+
+// filter shared between threads
+template <class T, int FingerprintBits = 12, class Hash = DefaultHash<T>>
+using CuckooConcurrentFilter = CuckooFilter<T, FingerprintBits, Hash, StripedLock>;
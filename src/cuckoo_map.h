@@ -0,0 +1,286 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "cuckoo_set.h"
+
+// storage policies of the values of a cuckoo map. a policy has a Holder<V> template that
+// holds one value, built in place from std::in_place and the constructor arguments, and
+// hands it out through get()
+
+// values live inline next to their keys: one cache miss per lookup, but every cuckoo
+// displacement moves the whole value
+struct InlineValue {
+    template <class V>
+    struct Holder {
+        V value;
+
+        Holder() = default;
+
+        template <class... Args>
+        explicit Holder(std::in_place_t, Args&&... args) : value(std::forward<Args>(args)...) {}
+
+        V& get() {
+            return value;
+        }
+
+        const V& get() const {
+            return value;
+        }
+    };
+};
+
+// values live out of line behind a shared handle, so displacing an entry moves a key and a
+// pointer however large the value. the set copies entries when it rebuilds its tables, and
+// those copies share the value instead of cloning it
+struct BoxedValue {
+    template <class V>
+    struct Holder {
+        std::shared_ptr<V> value;
+
+        Holder() = default;
+
+        template <class... Args>
+        explicit Holder(std::in_place_t, Args&&... args) : value(std::make_shared<V>(std::forward<Args>(args)...)) {}
+
+        V& get() {
+            return *value;
+        }
+
+        const V& get() const {
+            return *value;
+        }
+    };
+};
+
+// entry of a cuckoo map as stored in the set underneath: a key and the holder of its value,
+// equal to another entry or to a key when the keys are
+template <class K, class V, class ValueStorage>
+struct MapEntry {
+    K key;
+    typename ValueStorage::template Holder<V> value;
+
+    MapEntry() = default;
+
+    template <class Key, class... Args>
+    MapEntry(Key&& key, std::in_place_t, Args&&... args)
+            : key(std::forward<Key>(key)), value(std::in_place, std::forward<Args>(args)...) {}
+
+    bool operator==(const MapEntry& other) const {
+        return key == other.key;
+    }
+
+    template <class Key>
+    bool operator==(const Key& other) const {
+        return key == other;
+    }
+};
+
+// hash policy of the entries: the hash of their key. it is transparent, so the set is
+// searched by key without building an entry
+template <class Entry, class Hash>
+struct EntryHash {
+    using is_transparent = void;
+
+    Hash hash;
+
+    uint64_t operator()(const Entry& entry, uint64_t seed) const {
+        return hash(entry.key, seed);
+    }
+
+    template <class Key>
+    uint64_t operator()(const Key& key, uint64_t seed) const {
+        return hash(key, seed);
+    }
+};
+
+// cuckoo hash map from K to V on the machinery of CuckooSet: the tables hold entries hashed
+// by key, so lookups, inserts, displacement, the stash and resizing all work as in the set.
+// ValueStorage is InlineValue (the default) or BoxedValue for large values. K and V must be
+// default constructible, empty ways hold default entries.
+//
+// with StripedLock an entry is only changed under the stripes of its candidate buckets:
+// upsert and insert_or_assign update a present value in place under them, so no lookup
+// sees half an update, and find and find_for_update hand out the value with them still
+// held. get reads trivially copyable entries without any lock, like contains in the set
+template <class K, class V, int NumTables = 2, int BucketWays = 4, class Hash = DefaultHash<K>,
+          class LockPolicy = StripedLock, class ValueStorage = InlineValue>
+class CuckooMap : private CuckooSet<MapEntry<K, V, ValueStorage>, NumTables, BucketWays,
+                                    EntryHash<MapEntry<K, V, ValueStorage>, Hash>, LockPolicy> {
+    using Entry = MapEntry<K, V, ValueStorage>;
+    using Set = CuckooSet<Entry, NumTables, BucketWays, EntryHash<Entry, Hash>, LockPolicy>;
+
+    // function to build the entry of a key from the arguments of its value, called by the set
+    // only once the entry is sure to be stored
+    template <class Key, class... Args>
+    static auto make_entry(Key& key, Args&... args) {
+        return [&key, &args...]() {
+            return Entry(std::forward<Key>(key), std::in_place, std::forward<Args>(args)...);
+        };
+    }
+
+public:
+    // handle to the value of a key, empty when the key was absent. it keeps the stripes of
+    // the key's buckets locked until it is destroyed or released, which stops every writer to
+    // those buckets and every resize: keep it short, and do not use the map from the same
+    // thread while holding it. a ConstAccessor (from find) holds the stripes for reading, so
+    // lock-free lookups such as get and contains carry on. an Accessor (from
+    // find_for_update) may change the value, so it also blocks those lookups on its
+    // buckets until it is released
+    template <bool Mutable>
+    class BasicAccessor {
+        using Value = typename std::conditional<Mutable, V, const V>::type;
+
+        typename Set::EntryGuard guard;
+
+        friend class CuckooMap;
+
+    public:
+        explicit operator bool() const {
+            return guard.get() != nullptr;
+        }
+
+        const K& key() const {
+            return guard.get()->key;
+        }
+
+        Value& operator*() const {
+            return guard.get()->value.get();
+        }
+
+        Value* operator->() const {
+            return &guard.get()->value.get();
+        }
+
+        // function to unlock the buckets early, the value must not be used afterwards
+        void release() {
+            guard.release();
+        }
+    };
+
+    using ConstAccessor = BasicAccessor<false>;
+    using Accessor = BasicAccessor<true>;
+
+    using Set::Set;
+    using Set::size;
+    using Set::approximate_size;
+    using Set::set_max_load_factor;
+    using Set::set_rehash_threads;
+    using Set::reserve;
+    using Set::shrink_to_fit;
+    using Set::stats;
+    using Set::save;
+    using Set::open_mapped;
+
+    // function to find the value of a key to read it, kept from writers for as long as the
+    // accessor lives
+    ConstAccessor find(const K& key) {
+        return find_key<false>(key);
+    }
+
+    // function to find the value of a key of another type; only when the hash policy is
+    // transparent
+    template <class Key, class H = Hash, class = typename H::is_transparent>
+    ConstAccessor find(const Key& key) {
+        return find_key<false>(key);
+    }
+
+    // function to find the value of a key to change it, kept from writers and readers alike
+    // for as long as the accessor lives
+    Accessor find_for_update(const K& key) {
+        return find_key<true>(key);
+    }
+
+    template <class Key, class H = Hash, class = typename H::is_transparent>
+    Accessor find_for_update(const Key& key) {
+        return find_key<true>(key);
+    }
+
+    // function to copy the value of a key into out, false if the key is absent
+    bool get(const K& key, V& out) {
+        return get_key(key, out);
+    }
+
+    template <class Key, class H = Hash, class = typename H::is_transparent>
+    bool get(const Key& key, V& out) {
+        return get_key(key, out);
+    }
+
+    // function to check if a key is in the map
+    bool contains(const K& key) {
+        return Set::contains(key);
+    }
+
+    template <class Key, class H = Hash, class = typename H::is_transparent>
+    bool contains(const Key& key) {
+        return Set::contains(key);
+    }
+
+    // function to add a key with a value built from args, nothing happens if the key is
+    // present. true if it was added
+    template <class Key, class... Args>
+    bool insert(Key&& key, Args&&... args) {
+        return Set::insert_or_visit(key, [](Entry&) {}, make_entry<Key, Args...>(key, args...));
+    }
+
+    // function to set the value of a key, added if absent and assigned in place otherwise.
+    // true if it was added
+    template <class Key, class Value>
+    bool insert_or_assign(Key&& key, Value&& value) {
+        return Set::insert_or_visit(key, [&value](Entry& entry) {
+            entry.value.get() = std::forward<Value>(value);
+        }, make_entry<Key, Value>(key, value));
+    }
+
+    // function to call fn(value) on the value of a key under the locks of its buckets, or to
+    // add the key with a value built from args if it is absent. true if it was added
+    template <class Key, class F, class... Args>
+    bool upsert(Key&& key, F fn, Args&&... args) {
+        return Set::insert_or_visit(key, [&fn](Entry& entry) {
+            fn(entry.value.get());
+        }, make_entry<Key, Args...>(key, args...));
+    }
+
+    // function to call fn(value) on the value of a key under the locks of its buckets, false
+    // if the key is absent
+    template <class F>
+    bool update_fn(const K& key, F fn) {
+        return Set::visit(key, [&fn](Entry& entry) {
+            fn(entry.value.get());
+        });
+    }
+
+    // function to remove a key and its value
+    bool erase(const K& key) {
+        return Set::remove(key);
+    }
+
+    template <class Key, class H = Hash, class = typename H::is_transparent>
+    bool erase(const Key& key) {
+        return Set::remove(key);
+    }
+
+private:
+    template <bool Mutable, class Key>
+    BasicAccessor<Mutable> find_key(const Key& key) {
+        BasicAccessor<Mutable> accessor;
+        accessor.guard = Set::guard_entry(key, !Mutable);
+        return accessor;
+    }
+
+    template <class Key>
+    bool get_key(const Key& key, V& out) {
+        return Set::read(key, [&out](const Entry& entry) {
+            out = entry.value.get();
+        });
+    }
+};
+
+// map shared between threads, with values inline or, for large values, out of line
+template <class K, class V, class Hash = DefaultHash<K>>
+using CuckooConcurrentHashMap = CuckooMap<K, V, 2, 4, Hash, StripedLock>;
+
+template <class K, class V, class Hash = DefaultHash<K>>
+using CuckooConcurrentBoxedMap = CuckooMap<K, V, 2, 4, Hash, StripedLock, BoxedValue>;
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// longest chain of displacements tried before an insert gives up and the table grows
+constexpr int MAX_CUCKOO_PATH_LENGTH = 5;
+// most buckets a single search may visit, bounds the cost of a failed insert
+constexpr int MAX_CUCKOO_SEARCH_NODES = 512;
+
+// one hop of a cuckoo path: the value in `way` of bucket `index` of `table` moves to the
+// bucket of the next hop, which lies in another table. the way of the last hop is the free way that ends the path
+struct CuckooStep {
+    int table;
+    int index;
+    int way;
+};
+
+// function to search breadth-first for the shortest chain of displacements that frees a way
+// in one of the candidate buckets of a value, one candidate per table (candidates[t] is the
+// bucket of table t). free_ways(table, index) returns the bitmask of free ways of a bucket and
+// alternate(table, index, way, next_table) the bucket of next_table the value in that way
+// would move to (-1 if the way is no longer occupied). on success path holds the hops from a
+// candidate bucket to the bucket with the free way
+template <int TABLES, int WAYS, class FreeWays, class Alternate>
+bool search_cuckoo_path(const int* candidates, FreeWays&& free_ways, Alternate&& alternate,
+                        std::vector<CuckooStep>& path) {
+    struct Node {
+        int table;
+        int index;
+        int parent; // position of the parent node, -1 for a candidate bucket
+        int way;    // way of the parent whose value moves into this bucket
+        int depth;
+    };
+    static thread_local std::vector<Node> nodes;
+    nodes.clear();
+    for (int table = 0; table < TABLES; table++) {
+        nodes.push_back({table, candidates[table], -1, -1, 0});
+    }
+
+    for (size_t head = 0; head < nodes.size(); head++) {
+        Node node = nodes[head];
+        uint32_t free_mask = free_ways(node.table, node.index);
+        if (free_mask != 0) {
+            // walk back to the candidate bucket, then lay the hops out front to back
+            int length = node.depth + 1;
+            path.resize(length);
+            int way = __builtin_ctz(free_mask);
+            for (int at = static_cast<int>(head); at >= 0; at = nodes[at].parent) {
+                path[--length] = {nodes[at].table, nodes[at].index, way};
+                way = nodes[at].way;
+            }
+            return true;
+        }
+        if (node.depth + 1 >= MAX_CUCKOO_PATH_LENGTH) {
+            continue;
+        }
+        for (int way = 0; way < WAYS; way++) {
+            for (int next_table = 0; next_table < TABLES; next_table++) {
+                if (next_table == node.table || nodes.size() >= static_cast<size_t>(MAX_CUCKOO_SEARCH_NODES)) {
+                    continue;
+                }
+                int next_index = alternate(node.table, node.index, way, next_table);
+                if (next_index < 0) {
+                    break; // the way is empty, it has no alternates at all
+                }
+                // a bucket may appear only once on a path, otherwise the moves would overlap
+                bool on_path = false;
+                for (int at = static_cast<int>(head); at >= 0; at = nodes[at].parent) {
+                    if (nodes[at].table == next_table && nodes[at].index == next_index) {
+                        on_path = true;
+                        break;
+                    }
+                }
+                if (!on_path) {
+                    nodes.push_back({next_table, next_index, static_cast<int>(head), way, node.depth + 1});
+                }
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,1811 @@
+#pragma once
+
+#include <vector>
+#include <stdlib.h>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <type_traits>
+#include <thread>
+
+#include "aligned_allocator.h"
+#include "bucket.h"
+#include "cuckoo_path.h"
+#include "epoch.h"
+#include "hash_policy.h"
+#include "lock_table.h"
+#include "snapshot.h"
+#include "stash.h"
+#include "stats.h"
+
+// bucketized cuckoo hash set with NumTables hash functions (2 to 4) and BucketWays ways per
+// bucket (1 to 8), every probe loop over the tables unrolled at compile time. LockPolicy is
+// NoLock for a set used by one thread at a time or StripedLock for a set shared between
+// threads. Sequential and CuckooConcurrentHashSet are instantiations of it.
+//
+// with StripedLock, bucket i of every table is guarded by lock stripe i & (stripes - 1):
+// writers lock the stripes of the buckets they touch in ascending order, and readers of
+// trivially copyable values take no lock but validate the seqlock versions of the stripes
+// they read. growing is incremental: the doubled tables are published empty and the values
+// move over a few buckets at a time. with NoLock every lock compiles to nothing, shared
+// state is an ordinary variable and the tables are rebuilt in one pass.
+//
+// a value that finds no cuckoo path goes to a stash of STASH_SLOTS values searched linearly;
+// only an insert that fails with the stash full resizes, and every rebuild moves the stashed
+// values back into the tables where it can
+template <class T, int NumTables, int BucketWays, class Hash, class LockPolicy>
+class CuckooSet {
+    static_assert(NumTables >= 2 && NumTables <= 4, "a cuckoo set has 2, 3 or 4 hash functions");
+    static_assert(BucketWays >= 1 && BucketWays <= 8, "a bucket has 1 to 8 ways");
+
+public:
+    // outcome of add_in_place
+    enum class InPlace { ADDED, PRESENT, FULL };
+
+private:
+    static constexpr bool CONCURRENT = LockPolicy::CONCURRENT;
+    static constexpr int DEFAULT_LOCK_STRIPES = 1024;
+    // old buckets an add or remove drains into the new tables while a resize is in progress
+    static constexpr int DRAIN_BUCKETS_PER_OP = 4;
+    // an insert that finds no cuckoo path below this load factor blames the hash seed and
+    // rehashes at the same capacity, at most MAX_RESEEDS times before the tables double. the
+    // thresholds sit a little under the load bounded path searches reach for each shape
+    static constexpr double MIN_LOAD_TO_GROW = NumTables * BucketWays <= 2 ? 0.4
+                                             : NumTables * BucketWays <= 4 ? 0.7
+                                             : NumTables * BucketWays < 16 ? 0.85 : 0.9;
+    static constexpr int MAX_RESEEDS = 2;
+    static constexpr int STASH_SLOTS = 4;
+    // values each worker of a parallel rehash or bulk load should get at least, below that
+    // the threads cost more than they save
+    static constexpr size_t MIN_VALUES_PER_WORKER = 1 << 16;
+    // publication slots of the flat-combining mode, threads beyond that share them
+    static constexpr int COMBINING_SLOTS = 64;
+    // scans of the slots a combiner makes per turn, later scans pick up requests published
+    // while it applied the earlier ones
+    static constexpr int COMBINING_PASSES = 3;
+    // polls of its slot a waiting requester makes before it starts yielding the core
+    static constexpr unsigned COMBINING_SPINS = 256;
+
+    using TableBucket = Bucket<T, BucketWays>;
+    template <class U>
+    using Shared = typename LockPolicy::template Atomic<U>;
+    // stripes of the candidate buckets of a value plus those of a cuckoo path
+    using Stripes = StripeList<NumTables + MAX_CUCKOO_PATH_LENGTH>;
+
+    // all the tables of one size and hash seed, resize replaces them as a whole
+    struct Tables {
+        int capacity; // buckets in each table, always a power of two
+        uint64_t seed;
+        int reseeds;  // rehashes at this capacity before these tables
+        // the tables live back to back in one cache-line-aligned array: table t is
+        // [t * capacity, (t + 1) * capacity)
+        BucketArray<TableBucket> buckets;
+        // set once these tables are being drained into bigger ones
+        Tables* successor = nullptr;
+        Shared<size_t> drain_cursor{0}; // next bucket index handed out to a helper
+        Shared<size_t> drained{0};      // bucket indices fully drained by helpers
+        Tables(int capacity, uint64_t seed, int reseeds)
+                : capacity(capacity), seed(seed), reseeds(reseeds),
+                  buckets(static_cast<size_t>(NumTables) * capacity) {}
+
+        // constructor laying the tables over the buckets of a mapped snapshot
+        Tables(int capacity, uint64_t seed, int reseeds, TableBucket* mapped)
+                : capacity(capacity), seed(seed), reseeds(reseeds),
+                  buckets(mapped, static_cast<size_t>(NumTables) * capacity) {}
+
+        TableBucket& bucket(int table, int index) {
+            return buckets[static_cast<size_t>(table) * capacity + index];
+        }
+    };
+
+    // value waiting to be placed by a parallel build, with its hash under the seed of the build
+    struct Pending {
+        uint64_t hash;
+        T val;
+    };
+    // pending values of a parallel build, routed[from][to] is what worker from hands to worker to
+    using Routes = std::vector<std::vector<std::vector<Pending>>>;
+
+    // candidate buckets of a value, one per table, and its fingerprint
+    struct Location {
+        int index[NumTables];
+        uint8_t tag;
+    };
+
+    // location of a value computed ahead, by a batch, with the seed and capacity it holds
+    // for: tables without locks are freed when replaced, so their address may come back
+    struct Located {
+        uint64_t seed;
+        int capacity;
+        Location location;
+    };
+
+    // readers can reach the current tables without locks
+    Shared<Tables*> tables;
+    // tables still being drained into the current ones after a resize, nullptr otherwise
+    Shared<Tables*> old_tables{nullptr};
+    // every generation of tables published since the last shrink_to_fit, the current one
+    // last. a replaced generation gives its buckets back (see retire_buckets) but keeps its
+    // header, which writers holding a stale pointer still compare and read; since each
+    // resize doubles, at most MAX_RESEEDS rehashes happen at one capacity and a bulk load
+    // that fits adds in place, there are only a few dozen. without locks only the current
+    // generation is kept
+    std::vector<std::unique_ptr<Tables>> generations;
+    // snapshot the tables were last opened from, their buckets live in it until they are
+    // rebuilt on the heap
+    std::unique_ptr<MappedFile> mapping;
+    LockPolicy locks;
+    // value count, in cache-line shards picked by bucket index: with locks one per stripe,
+    // updated by the holder of the stripe, without locks enough that transactions adding to
+    // different buckets rarely meet on one
+    struct alignas(CACHE_LINE_SIZE) CountShard {
+        Shared<int64_t> values{0};
+    };
+    static constexpr int COUNT_SHARDS = 64;
+    int count_shards;
+    std::unique_ptr<CountShard[]> counts;
+    // values that found no place in the tables, guarded by its own lock
+    Stash<T, STASH_SLOTS, LockPolicy> stash;
+    std::vector<CuckooStep> scratch_path; // cuckoo path of an insert, without locks
+    int batch_size = DEFAULT_BATCH_SIZE; // keys the batched operations hash and prefetch together
+    int rehash_threads = std::max(1u, std::thread::hardware_concurrency()); // most workers of a rebuild
+    // load factor past which an insert whose buckets are full grows the tables instead of
+    // searching a cuckoo path, 1 to grow only when no path is found
+    double max_load_factor = 1;
+    StatsRecorder<CONCURRENT> counters; // hot-path counters, empty unless CUCKOO_STATS is defined
+    Hash hasher;
+    // flat combining (see set_combining): a writer publishes its add or remove in a slot and
+    // the thread holding the combiner lock applies every published request
+    enum CombiningState { SLOT_FREE, SLOT_CLAIMED, SLOT_PENDING, SLOT_DONE };
+    struct alignas(CACHE_LINE_SIZE) CombiningSlot {
+        std::atomic<int> state{SLOT_FREE};
+        bool (*run)(CuckooSet&, const void*) = nullptr; // the request, applied to arg
+        const void* arg = nullptr;
+        uint64_t hash = 0; // of the value under the seed the requester saw, to prefetch its buckets
+        bool result = false;
+    };
+    Shared<bool> combining{false};
+    std::unique_ptr<CombiningSlot[]> combining_slots; // only with locks
+    std::atomic<int> combining_used{0}; // slots ever claimed are below this, the combiner scans those
+    SpinLock combiner;
+
+    // pin of the epoch (see epoch.h) for a read of buckets that may be retired meanwhile,
+    // taken before the tables are loaded; nothing without locks
+    struct ReadPin {
+        ReadPin() {
+            if constexpr (CONCURRENT) {
+                EpochDomain::global().enter();
+            }
+        }
+
+        ReadPin(const ReadPin&) = delete;
+        ReadPin& operator=(const ReadPin&) = delete;
+
+        ~ReadPin() {
+            if constexpr (CONCURRENT) {
+                EpochDomain::global().leave();
+            }
+        }
+    };
+
+    // function to call f(table) for every table, unrolled at compile time
+    template <class F, int... Table>
+    static void each_table(F&& f, std::integer_sequence<int, Table...>) {
+        (f(Table), ...);
+    }
+
+    template <class F>
+    static void each_table(F&& f) {
+        each_table(f, std::make_integer_sequence<int, NumTables>());
+    }
+
+    // function to get the first table for which f(table) is true, -1 if there is none,
+    // unrolled at compile time
+    template <class F, int... Table>
+    static int first_table(F&& f, std::integer_sequence<int, Table...>) {
+        int found = -1;
+        (void)((f(Table) ? (found = Table, true) : false) || ...);
+        return found;
+    }
+
+    template <class F>
+    static int first_table(F&& f) {
+        return first_table(f, std::make_integer_sequence<int, NumTables>());
+    }
+
+    // function to hash a value, or a key of a transparent hash policy, with the seed of the
+    // given tables
+    template <class K>
+    uint64_t hash(const K& val, const Tables& target) const {
+        return hasher(val, target.seed);
+    }
+
+    // function to get the bucket of a hash in one table
+    static int index_of(uint64_t val_hash, int table, const Tables& target) {
+        return reduce_mask(hash_part(val_hash, table), target.capacity);
+    }
+
+    // function to get the candidate buckets and the fingerprint of a value
+    template <class K>
+    Location locate(const K& val, const Tables& target) const {
+        uint64_t val_hash = hash(val, target);
+        Location location;
+        each_table([&](int table) {
+            location.index[table] = index_of(val_hash, table, target);
+        });
+        location.tag = fingerprint(val_hash);
+        return location;
+    }
+
+    // function to get the location of a value in current, reusing known (if any) when it was
+    // computed for the same seed and capacity
+    template <class K>
+    Location locate_known(const K& val, const Tables* current, const Located* known) const {
+        return known != nullptr && known->seed == current->seed && known->capacity == current->capacity
+                       ? known->location : locate(val, *current);
+    }
+
+    // function to find a value in its candidate buckets: the table holding it, with its way
+    // stored in way, or -1
+    template <class K>
+    int find(Tables& current, const Location& location, const K& val, int& way) {
+        return first_table([&](int table) {
+            way = current.bucket(table, location.index[table]).find(location.tag, val);
+            return way >= 0;
+        });
+    }
+
+    // function to pick the least loaded candidate bucket with a free way (the first table on
+    // a tie), -1 if every candidate is full
+    int least_loaded(Tables& current, const Location& location) {
+        int best = -1;
+        int best_count = BucketWays;
+        each_table([&](int table) {
+            int count = current.bucket(table, location.index[table]).count();
+            if (count < best_count) {
+                best = table;
+                best_count = count;
+            }
+        });
+        return best;
+    }
+
+    // function to append a value to a bucket that is known to have a free way, moved in when
+    // it is an rvalue
+    template <class V>
+    void push(TableBucket& bucket, V&& val, uint8_t val_tag) {
+        bucket.store(__builtin_ctz(bucket.empty_ways()), val_tag, T(std::forward<V>(val)));
+    }
+
+    // function to shift values along a cuckoo path from its end back to its start and store
+    // the value in the way freed at the start, the caller owns every bucket on the path. the
+    // displaced values are moved, never copied
+    template <class V>
+    void apply_path(Tables& current, const std::vector<CuckooStep>& path, V&& val, uint8_t val_tag) {
+        counters.relocation(path.size() - 1);
+        for (size_t hop = path.size() - 1; hop > 0; hop--) {
+            TableBucket& from = current.bucket(path[hop - 1].table, path[hop - 1].index);
+            from.move_to(path[hop - 1].way, current.bucket(path[hop].table, path[hop].index), path[hop].way);
+        }
+        current.bucket(path[0].table, path[0].index).store(path[0].way, val_tag, T(std::forward<V>(val)));
+    }
+
+    // function to lock the stripes of the candidate buckets of a value plus every bucket of a
+    // cuckoo path (path_length hops, possibly none), in ascending stripe order so that two
+    // writers can never wait on each other. false if the tables were replaced before the
+    // locks were taken, nothing is held then
+    bool acquire_path(const Location& location, const CuckooStep* path, size_t path_length, Tables* expected,
+                      Stripes& held) {
+        if constexpr (!CONCURRENT) {
+            return true;
+        }
+        held.clear();
+        each_table([&](int table) {
+            held.push(locks.stripe_of(location.index[table]));
+        });
+        for (size_t hop = 0; hop < path_length; hop++) {
+            held.push(locks.stripe_of(path[hop].index));
+        }
+        locks.lock(held);
+        if (expected != tables.load(std::memory_order_relaxed)) {
+            locks.unlock(held);
+            return false;
+        }
+        return true;
+    }
+
+    // function to search a cuckoo path for a value whose buckets are all full. every bucket
+    // is read under its own lock, but no lock is held across the search, so the path has to
+    // be validated again once its buckets are locked
+    bool search_path(const Location& location, Tables* expected, std::vector<CuckooStep>& path) {
+        auto free_ways = [this, expected](int table, int index) -> uint32_t {
+            size_t stripe = locks.stripe_of(index);
+            if (old_tables.load(std::memory_order_acquire) == nullptr) {
+                std::lock_guard<typename LockPolicy::ReaderLock> guard(locks.reader_lock(stripe));
+                return expected == tables.load(std::memory_order_relaxed) ? expected->bucket(table, index).empty_ways() : 0;
+            }
+            // the bucket may still have to take values from the old tables, drain them first
+            locks.lock(stripe);
+            uint32_t free_mask = 0;
+            if (expected == tables.load(std::memory_order_relaxed)) {
+                settle(*expected, table, index);
+                free_mask = expected->bucket(table, index).empty_ways();
+            }
+            locks.unlock(stripe);
+            return free_mask;
+        };
+        auto alternate = [this, expected](int table, int index, int way, int next_table) -> int {
+            std::lock_guard<typename LockPolicy::ReaderLock> guard(locks.reader_lock(locks.stripe_of(index)));
+            if (expected != tables.load(std::memory_order_relaxed)) {
+                return -1; // replaced, its buckets may be gone
+            }
+            const TableBucket& bucket = expected->bucket(table, index);
+            if (bucket.tags[way] == TableBucket::EMPTY) {
+                return -1;
+            }
+            return index_of(hash(bucket.keys[way], *expected), next_table, *expected);
+        };
+        return search_cuckoo_path<NumTables, BucketWays>(location.index, free_ways, alternate, path);
+    }
+
+    // function to check, with the path locked, that it still starts at a candidate bucket of
+    // the value, that every hop still moves a value to one of its other buckets and that the
+    // last hop still ends on a free way
+    bool path_valid(Tables& current, const Location& location, const std::vector<CuckooStep>& path) {
+        if (path[0].index != location.index[path[0].table]) {
+            return false;
+        }
+        for (size_t hop = 0; hop + 1 < path.size(); hop++) {
+            const TableBucket& bucket = current.bucket(path[hop].table, path[hop].index);
+            if (bucket.tags[path[hop].way] == TableBucket::EMPTY) {
+                return false;
+            }
+            const T& key = bucket.keys[path[hop].way];
+            if (index_of(hash(key, current), path[hop + 1].table, current) != path[hop + 1].index) {
+                return false;
+            }
+        }
+        const CuckooStep& last = path.back();
+        return current.bucket(last.table, last.index).tags[last.way] == TableBucket::EMPTY;
+    }
+
+    // function to move every value of an old bucket to its place in the successor tables,
+    // which keep the hash seed of the old ones (so the fingerprints stay valid). doubling splits
+    // old bucket i of a table between new buckets i and i + old capacity, and no value enters
+    // either of them before bucket i is drained, so both always have room. the caller holds
+    // the stripe of index, which also guards both new buckets
+    void drain_bucket(Tables& from, int table, int index) {
+        Tables& to = *from.successor;
+        TableBucket& bucket = from.bucket(table, index);
+        for (uint32_t used = ~bucket.empty_ways() & TableBucket::ALL_WAYS; used != 0; used &= used - 1) {
+            int way = __builtin_ctz(used);
+            TableBucket& target = to.bucket(table, index_of(hash(bucket.keys[way], to), table, to));
+            bucket.move_to(way, target, __builtin_ctz(target.empty_ways()));
+        }
+    }
+
+    // function to drain the old bucket that feeds a bucket of the current tables before the
+    // bucket is read or written, while a resize is in progress. the caller holds its stripe
+    void settle(Tables& current, int table, int index) {
+        if constexpr (CONCURRENT) {
+            if (old_tables.load(std::memory_order_acquire) == nullptr) {
+                return;
+            }
+            ReadPin pin; // the helper draining the last old bucket retires them at once
+            Tables* from = old_tables.load(std::memory_order_acquire);
+            if (from != nullptr && from->successor == &current) {
+                drain_bucket(*from, table, index & (from->capacity - 1));
+            }
+        }
+    }
+
+    // function to drain the next few old buckets, false if there was nothing left to hand out.
+    // the helper that drains the last one retires the old tables
+    bool help_drain() {
+        if constexpr (!CONCURRENT) {
+            return false;
+        }
+        Tables* from = old_tables.load(std::memory_order_acquire);
+        if (from == nullptr) {
+            return false;
+        }
+        size_t count = from->capacity;
+        size_t start = from->drain_cursor.fetch_add(DRAIN_BUCKETS_PER_OP, std::memory_order_relaxed);
+        if (start >= count) {
+            return false;
+        }
+        size_t end = std::min(start + DRAIN_BUCKETS_PER_OP, count);
+        for (size_t index = start; index < end; index++) {
+            size_t stripe = locks.stripe_of(index);
+            locks.lock(stripe);
+            each_table([&](int table) {
+                drain_bucket(*from, table, index);
+            });
+            locks.unlock(stripe);
+        }
+        if (from->drained.fetch_add(end - start, std::memory_order_acq_rel) + (end - start) == count) {
+            old_tables.store(nullptr, std::memory_order_release);
+            retire_buckets(*from);
+        }
+        return true;
+    }
+
+    // function to give back the buckets of tables that were just replaced, keeping their
+    // header. with locks they are retired to the epoch domain, since a lock-free reader or a
+    // settle may still be reading them, and freed once every thread pinned meanwhile has
+    // left; the caller has already unlinked them
+    void retire_buckets(Tables& replaced) {
+        if constexpr (CONCURRENT) {
+            EpochDomain& domain = EpochDomain::global();
+            std::atomic_thread_fence(std::memory_order_seq_cst); // the unlink is seen before any later pin
+            domain.retire(replaced.buckets.release());
+            domain.reclaim();
+        }
+    }
+
+    // function to help drain the old tables until no resize is in progress
+    void finish_drain() {
+        while (old_tables.load(std::memory_order_acquire) != nullptr) {
+            if (!help_drain()) {
+                std::this_thread::yield(); // the last buckets are being drained by other threads
+            }
+        }
+    }
+
+    // function to wait until no resize is in progress and stop every writer, returns the
+    // current tables. the caller restarts the writers with locks.unlock_all
+    Tables& stop_writers() {
+        for (;;) {
+            finish_drain();
+            locks.lock_all();
+            if (old_tables.load(std::memory_order_relaxed) == nullptr) {
+                return *tables.load(std::memory_order_relaxed);
+            }
+            locks.unlock_all(); // another resize started meanwhile
+        }
+    }
+
+    // function to replace the current tables, with every writer stopped, by tables of at
+    // least capacity buckets holding their values, the stashed ones and those of [first,
+    // last), built by up to most_workers threads; the capacity doubles until everything fits.
+    // the values are moved out of the current tables, which are discarded, and an attempt
+    // that found no room hands its values on to the next. restarts the writers and returns
+    // how many values were new
+    template <class Iterator>
+    size_t rebuild_exclusive(Tables& current, int capacity, Iterator first, Iterator last, int most_workers) {
+        StatsTimer timer;
+        size_t count = std::distance(first, last);
+        size_t existing = counted_values();
+        int workers = workers_for(existing + count, most_workers);
+        std::unique_ptr<Tables> built;
+        std::unique_ptr<Tables> full; // tables of the last attempt, holding most of the values
+        std::vector<std::vector<Pending>> inputs(workers); // the rest of them after an attempt
+        unsigned stashed = 0; // stash slots whose values went into the new tables
+        for (Tables* source = &current;; capacity *= 2) {
+            built.reset(new Tables(capacity, current.seed, 0));
+            parallel_for(workers, [&](int worker) {
+                collect_slice(*source, *built, worker, workers, inputs[worker], true);
+                if (source != &current) {
+                    return; // the new values are in the tables of the last attempt already
+                }
+                Iterator it = std::next(first, count * worker / workers);
+                for (size_t i = count * worker / workers; i < count * (worker + 1) / workers; i++, ++it) {
+                    inputs[worker].push_back(Pending{hash(*it, *built), *it});
+                }
+            });
+            for (int slot = 0; slot < STASH_SLOTS && source == &current; slot++) {
+                T val;
+                if (stash.copy_slot(slot, val)) {
+                    inputs[0].push_back(Pending{hash(val, *built), std::move(val)});
+                    stashed |= 1u << slot;
+                }
+            }
+            if (build_parallel(*built, inputs)) {
+                break;
+            }
+            full = std::move(built);
+            source = full.get(); // same seed, so the hashes of the values left in inputs still hold
+        }
+        size_t values = count_values(*built);
+        bool grew = capacity > current.capacity;
+        if constexpr (CONCURRENT) {
+            generations.push_back(std::move(built));
+            tables.store(generations.back().get(), std::memory_order_release);
+            retire_buckets(current); // lock-free readers may still probe them
+        } else {
+            generations.back() = std::move(built);
+            tables.store(generations.back().get(), std::memory_order_release);
+        }
+        unstash(stashed);
+        reset_count(values);
+        locks.unlock_all();
+        if (grew) {
+            counters.resize(timer.elapsed_ns());
+        }
+        return values - existing;
+    }
+
+    // function to place a value in tables no other thread can reach, displacing values along
+    // a cuckoo path when every candidate bucket is full, moved in when it is an rvalue. false
+    // if there is no path, the value is left as it was then
+    template <class V>
+    bool place_private(Tables& target, V&& val) {
+        Location location = locate(val, target);
+        int table = least_loaded(target, location);
+        if (table >= 0) {
+            push(target.bucket(table, location.index[table]), std::forward<V>(val), location.tag);
+            return true;
+        }
+        auto free_ways = [&target](int table, int index) {
+            return target.bucket(table, index).empty_ways();
+        };
+        auto alternate = [this, &target](int table, int index, int way, int next_table) {
+            return index_of(hash(target.bucket(table, index).keys[way], target), next_table, target);
+        };
+        if (!search_cuckoo_path<NumTables, BucketWays>(location.index, free_ways, alternate, scratch_path)) {
+            return false;
+        }
+        apply_path(target, scratch_path, std::forward<V>(val), location.tag);
+        return true;
+    }
+
+    // function to rehash every value of from into the empty tables to, false if one found no place
+    bool rehash_into(Tables& from, Tables& to) {
+        for (TableBucket& bucket : from.buckets) {
+            for (uint32_t used = ~bucket.empty_ways() & TableBucket::ALL_WAYS; used != 0; used &= used - 1) {
+                if (!place_private(to, bucket.keys[__builtin_ctz(used)])) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // function to place the stashed values in tables no other thread can reach yet, returns
+    // the mask of the slots placed; they stay stashed until unstash drops them
+    unsigned place_stashed(Tables& target) {
+        unsigned placed = 0;
+        for (int slot = 0; slot < STASH_SLOTS; slot++) {
+            T val;
+            if (stash.copy_slot(slot, val) && place_private(target, val)) {
+                placed |= 1u << slot;
+            }
+        }
+        return placed;
+    }
+
+    // function to drop the stash slots of a mask returned by place_stashed, once the tables
+    // holding their values are published
+    void unstash(unsigned placed) {
+        if (placed == 0) {
+            return;
+        }
+        stash.lock();
+        for (int slot = 0; slot < STASH_SLOTS; slot++) {
+            if (placed & (1u << slot)) {
+                stash.erase(slot);
+            }
+        }
+        stash.unlock();
+    }
+
+    // function to move the stashed values into the current tables after they grew, each
+    // under the stripes of its candidate buckets like an add. the ones still without a free
+    // way stay stashed
+    void drain_stash() {
+        for (int slot = 0; slot < STASH_SLOTS && !stash.empty(); slot++) {
+            T val;
+            if (!stash.copy_slot(slot, val)) {
+                continue;
+            }
+            Stripes held;
+            Location location;
+            Tables* current = lock_candidates(val, location, held);
+            int table = least_loaded(*current, location);
+            if (table >= 0) {
+                stash.lock();
+                int stashed = stash.find(val); // -1 if removed meanwhile
+                if (stashed >= 0) {
+                    push(current->bucket(table, location.index[table]), std::move(val), location.tag);
+                    stash.erase(stashed);
+                }
+                stash.unlock();
+            }
+            locks.unlock(held);
+        }
+    }
+
+    // function to add the values of [first, last) to the current tables the way add does,
+    // split between up to most_workers threads with locks, returns how many were new
+    template <class Iterator>
+    size_t add_range(Iterator first, Iterator last, int most_workers) {
+        size_t count = std::distance(first, last);
+        int workers = CONCURRENT ? workers_for(count, most_workers) : 1;
+        std::vector<size_t> added(workers, 0);
+        parallel_for(workers, [&](int worker) {
+            Iterator it = std::next(first, count * worker / workers);
+            for (size_t i = count * worker / workers; i < count * (worker + 1) / workers; i++, ++it) {
+                added[worker] += add_value(*it);
+            }
+        });
+        size_t total = 0;
+        for (size_t worker_added : added) {
+            total += worker_added;
+        }
+        return total;
+    }
+
+    // function to run f(worker) for workers workers at once, the calling thread is worker 0
+    template <class F>
+    static void parallel_for(int workers, F&& f) {
+        std::vector<std::thread> threads;
+        for (int worker = 1; worker < workers; worker++) {
+            threads.emplace_back([&f, worker] {
+                f(worker);
+            });
+        }
+        f(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // function to get how many workers a rebuild of the given number of values is worth
+    int workers_for(size_t values, int most) const {
+        return static_cast<int>(std::max<size_t>(1, std::min<size_t>(most, values / MIN_VALUES_PER_WORKER)));
+    }
+
+    // function to hash slice worker of the values of some tables with the seed of target,
+    // moving them out when take is set (a trivially copyable value is only copied, so
+    // lock-free readers can go on probing from) and copying them otherwise
+    void collect_slice(Tables& from, const Tables& target, int worker, int workers, std::vector<Pending>& out,
+                       bool take = false) {
+        size_t begin = from.buckets.size() * worker / workers;
+        size_t end = from.buckets.size() * (worker + 1) / workers;
+        for (size_t i = begin; i < end; i++) {
+            TableBucket& bucket = from.buckets[i];
+            for (uint32_t used = ~bucket.empty_ways() & TableBucket::ALL_WAYS; used != 0; used &= used - 1) {
+                T& val = bucket.keys[__builtin_ctz(used)];
+                uint64_t val_hash = hash(val, target);
+                out.push_back(take ? Pending{val_hash, std::move(val)} : Pending{val_hash, val});
+            }
+        }
+    }
+
+    // function to place pending values in empty tables no other thread can reach, one worker
+    // per slice of inputs. the buckets of each table are split into one range per worker,
+    // and the values are handed to the owner of their bucket in table 0; what finds that
+    // bucket full goes on to the owner of its bucket in table 1, and so on, so no bucket is
+    // ever shared and no lock is taken. every copy of a value takes the same route, which
+    // drops duplicates. the few values left over once every table was tried are placed
+    // one at a time with cuckoo paths. false if some of them found no place, those are left
+    // in inputs[0] and every other value in target
+    bool build_parallel(Tables& target, std::vector<std::vector<Pending>>& inputs) {
+        int workers = static_cast<int>(inputs.size());
+        auto owner = [&target, workers](uint64_t val_hash, int table) {
+            return static_cast<int>(static_cast<size_t>(index_of(val_hash, table, target)) * workers / target.capacity);
+        };
+        Routes routed(workers, std::vector<std::vector<Pending>>(workers));
+        parallel_for(workers, [&](int worker) {
+            for (Pending& pending : inputs[worker]) {
+                routed[worker][owner(pending.hash, 0)].push_back(std::move(pending));
+            }
+            std::vector<Pending>().swap(inputs[worker]);
+        });
+        std::vector<std::vector<Pending>> leftovers(workers);
+        for (int table = 0; table < NumTables; table++) {
+            Routes next(workers, std::vector<std::vector<Pending>>(table + 1 < NumTables ? workers : 0));
+            parallel_for(workers, [&](int worker) {
+                for (int from = 0; from < workers; from++) {
+                    for (Pending& pending : routed[from][worker]) {
+                        TableBucket& bucket = target.bucket(table, index_of(pending.hash, table, target));
+                        uint8_t val_tag = fingerprint(pending.hash);
+                        if (bucket.find(val_tag, pending.val) >= 0) {
+                            continue; // a copy of the value took the same route
+                        }
+                        if (bucket.empty_ways() != 0) {
+                            push(bucket, pending.val, val_tag);
+                        } else if (table + 1 < NumTables) {
+                            next[worker][owner(pending.hash, table + 1)].push_back(std::move(pending));
+                        } else {
+                            leftovers[worker].push_back(std::move(pending));
+                        }
+                    }
+                    std::vector<Pending>().swap(routed[from][worker]);
+                }
+            });
+            routed = std::move(next);
+        }
+        for (std::vector<Pending>& left : leftovers) {
+            for (Pending& pending : left) {
+                int way;
+                if (find(target, locate(pending.val, target), pending.val, way) < 0
+                        && !place_private(target, std::move(pending.val))) {
+                    inputs[0].push_back(std::move(pending));
+                }
+            }
+        }
+        return inputs[0].empty();
+    }
+
+    // function to rehash every value of from into the empty tables to, with a worker per
+    // slice of the buckets once there are enough values, false if one found no place
+    bool rehash_parallel(Tables& from, Tables& to) {
+        int workers = workers_for(counted_values(), rehash_threads);
+        if (workers == 1) {
+            return rehash_into(from, to);
+        }
+        std::vector<std::vector<Pending>> inputs(workers);
+        parallel_for(workers, [&](int worker) {
+            collect_slice(from, to, worker, workers, inputs[worker]);
+        });
+        return build_parallel(to, inputs);
+    }
+
+    // function to change the value count of the shard of a bucket index, the caller holds
+    // the stripe of the index, which with locks is the only one mapped to that shard
+    void count_change(int index, int64_t delta) {
+        Shared<int64_t>& shard = counts[index & (count_shards - 1)].values;
+        shard.store(shard.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    // function to sum the count shards without locks. a shard can be read before another
+    // one it was moved from, so the sum may be briefly off while writers run
+    size_t counted_values() const {
+        int64_t values = 0;
+        for (int shard = 0; shard < count_shards; shard++) {
+            values += counts[shard].values.load(std::memory_order_relaxed);
+        }
+        return values < 0 ? 0 : values;
+    }
+
+    // function to set the value count after the tables were rebuilt, every writer is stopped
+    void reset_count(size_t values) {
+        for (int shard = 0; shard < count_shards; shard++) {
+            counts[shard].values.store(shard == 0 ? values : 0, std::memory_order_relaxed);
+        }
+    }
+
+    // function to count the values of some tables by reading every bucket
+    static size_t count_values(const Tables& counted) {
+        size_t values = 0;
+        for (const TableBucket& bucket : counted.buckets) {
+            values += bucket.count();
+        }
+        return values;
+    }
+
+    // function to get the load factor of the tables holding every value, from the count shards
+    double load_of(const Tables& counted) const {
+        return (static_cast<double>(counted_values()) - stash.size()) / (counted.buckets.size() * BucketWays);
+    }
+
+    // function to rebuild the tables in one pass, without locks. below MIN_LOAD_TO_GROW the
+    // capacity stays and the seed changes, otherwise (or once MAX_RESEEDS rehashes in a row
+    // did not help) the capacity doubles; repeated until every value found a place
+    void rebuild() {
+        StatsTimer timer;
+        Tables& current = *tables.load();
+        double load = load_of(current);
+        int capacity = current.capacity;
+        uint64_t seed = current.seed;
+        int reseeds = current.reseeds;
+        for (;;) {
+            bool reseeding = load < MIN_LOAD_TO_GROW && reseeds < MAX_RESEEDS;
+            if (reseeding) {
+                seed = next_seed(seed);
+                reseeds++;
+            } else {
+                capacity *= 2; // double the capacity
+                reseeds = 0;
+                load /= 2;
+            }
+            std::unique_ptr<Tables> rebuilt(new Tables(capacity, seed, reseeds));
+            if (rehash_parallel(current, *rebuilt)) {
+                unsigned placed = place_stashed(*rebuilt);
+                generations.back() = std::move(rebuilt);
+                tables.store(generations.back().get());
+                unstash(placed);
+                if (reseeding) {
+                    counters.reseed(timer.elapsed_ns());
+                } else {
+                    counters.resize(timer.elapsed_ns());
+                }
+                return;
+            }
+        }
+    }
+
+    // function to make room after an insert found no cuckoo path, unless another thread
+    // already replaced expected. below MIN_LOAD_TO_GROW the failure is blamed on the hash
+    // seed: the values are rehashed with a new seed into tables of the same capacity, with
+    // every writer stopped, and published as a whole. otherwise the tables double; only the
+    // empty bigger tables are allocated here, the values move over incrementally: every add
+    // and remove drains a few old buckets, and any bucket an operation touches is drained first
+    void resize(Tables* expected) {
+        if constexpr (!CONCURRENT) {
+            rebuild();
+            return;
+        }
+        StatsTimer timer;
+        // a resize still in progress is finished first, so at most two generations are live
+        finish_drain();
+        locks.lock_all(); // stops every writer, readers keep probing the current tables
+        if (expected == tables.load(std::memory_order_relaxed) && old_tables.load(std::memory_order_relaxed) == nullptr) {
+            if (load_of(*expected) < MIN_LOAD_TO_GROW && expected->reseeds < MAX_RESEEDS) {
+                std::unique_ptr<Tables> reseeded(new Tables(expected->capacity, next_seed(expected->seed), expected->reseeds + 1));
+                if (rehash_parallel(*expected, *reseeded)) {
+                    unsigned placed = place_stashed(*reseeded);
+                    generations.push_back(std::move(reseeded));
+                    tables.store(generations.back().get(), std::memory_order_release);
+                    retire_buckets(*expected);
+                    // dropped only after the publish, so a reader that misses them in the
+                    // stash sees the tables change
+                    unstash(placed);
+                    locks.unlock_all();
+                    counters.reseed(timer.elapsed_ns());
+                    return;
+                }
+            }
+            generations.emplace_back(new Tables(expected->capacity * 2, expected->seed, 0));
+            expected->successor = generations.back().get();
+            old_tables.store(expected, std::memory_order_release);
+            tables.store(expected->successor, std::memory_order_release);
+            locks.unlock_all();
+            counters.resize(timer.elapsed_ns()); // the values move over later, one bucket at a time
+            drain_stash();
+            return;
+        }
+        locks.unlock_all();
+    }
+
+    // function to probe every candidate bucket of a value without locks, given its location
+    // in current, calling read(value) on the value found. false if a writer held or took one
+    // of the stripes, or the tables were replaced, in which case found and whatever read saw
+    // are meaningless and the probe has to be retried. the caller holds a ReadPin taken
+    // before it loaded current, so the buckets of replaced tables stay readable
+    template <class K, class F>
+    bool try_probe(Tables* current, const K& val, const Location& location, bool& found, F&& read) {
+        Tables* from = old_tables.load(std::memory_order_acquire);
+        uint64_t before[NumTables];
+        uint64_t odd = 0;
+        each_table([&](int table) {
+            before[table] = locks.read_begin(locks.stripe_of(location.index[table]));
+            odd |= before[table];
+        });
+        if (odd & 1) {
+            return false;
+        }
+        int way;
+        int table = find(*current, location, val, way);
+        found = table >= 0;
+        unsigned probed = found ? table + 1 : NumTables;
+        if (found) {
+            read(current->bucket(table, location.index[table]).keys[way]);
+        } else if (from != nullptr && from->successor == current) {
+            found = first_table([&](int table) {
+                const TableBucket& bucket = from->bucket(table, location.index[table] & (from->capacity - 1));
+                way = bucket.find(location.tag, val);
+                if (way >= 0) {
+                    read(bucket.keys[way]);
+                }
+                return way >= 0;
+            }) >= 0;
+            probed += NumTables;
+        }
+        // a value moving between the stash and a bucket does so under the candidate stripes
+        if (!found && !stash.empty() && !stash.try_probe(val, found, read)) {
+            return false;
+        }
+        counters.probed(probed);
+        bool unchanged = true;
+        each_table([&](int table) {
+            unchanged &= locks.read_validate(locks.stripe_of(location.index[table]), before[table]);
+        });
+        return unchanged && current == tables.load(std::memory_order_acquire);
+    }
+
+    // function to hash a group of values in the current tables and prefetch every candidate
+    // bucket of each, the locations go to located. returns the tables they were computed in
+    Tables* prefetch_group(const T* keys, size_t count, bool for_write, Located* located) {
+        Tables* current = tables.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            located[i] = Located{current->seed, current->capacity, locate(keys[i], *current)};
+            each_table([&](int table) {
+                if (for_write) {
+                    current->bucket(table, located[i].location.index[table]).prefetch_for_write();
+                } else {
+                    current->bucket(table, located[i].location.index[table]).prefetch();
+                }
+            });
+        }
+        return current;
+    }
+
+    // function to lock the candidate buckets of a value in the current tables and drain
+    // the old buckets that feed them, returns the tables they belong to
+    template <class K>
+    Tables* lock_candidates(const K& val, Location& location, Stripes& held, const Located* known = nullptr) {
+        for (;;) {
+            Tables* current = tables.load(std::memory_order_acquire);
+            location = locate_known(val, current, known);
+            if (acquire_path(location, nullptr, 0, current, held)) {
+                each_table([&](int table) {
+                    settle(*current, table, location.index[table]);
+                });
+                return current;
+            }
+        }
+    }
+
+    // function to take the candidate stripes of a value for reading only (see
+    // LockTable::lock_readers), returns the tables they belong to. nothing is drained, a
+    // resize in progress may still hold the value in the old tables
+    template <class K>
+    Tables* lock_candidates_shared(const K& val, Location& location, Stripes& held) {
+        for (;;) {
+            Tables* current = tables.load(std::memory_order_acquire);
+            location = locate(val, *current);
+            held.clear();
+            each_table([&](int table) {
+                held.push(locks.stripe_of(location.index[table]));
+            });
+            locks.lock_readers(held);
+            if (current == tables.load(std::memory_order_relaxed)) {
+                return current;
+            }
+            locks.unlock_readers(held);
+        }
+    }
+
+protected:
+    // function to find the value equal to key and call found(value) on it under the locks of
+    // its bucket, or else store make() in one of its buckets (or the stash). make is only
+    // called once the value is sure to be stored, so it can move from its source. true if
+    // make() was stored. known is the location of key computed ahead, if any
+    template <class K, class Found, class Make>
+    bool insert_or_visit(const K& key, Found&& found, Make&& make, const Located* known = nullptr) {
+        if constexpr (!CONCURRENT) {
+            InPlace outcome = in_place_or_visit(key, found, make, known);
+            if (outcome != InPlace::FULL) {
+                return outcome == InPlace::ADDED; // false if value already exists
+            }
+        }
+        std::vector<CuckooStep> local_path;
+        // cuckoo path found by the last search, empty at first
+        std::vector<CuckooStep>& path = CONCURRENT ? local_path : scratch_path;
+        path.clear();
+        Tables* path_tables = nullptr; // the tables the last search ran against
+        bool stash_next = false; // the last search found no path, the value goes to the stash
+        Stripes held;
+        for (;;) {
+            Tables* current = tables.load(std::memory_order_acquire);
+            if (current != path_tables) {
+                path.clear(); // resized or reseeded since the search, the path is meaningless now
+                stash_next = false;
+            }
+            Location location = locate_known(key, current, known);
+            if (!acquire_path(location, path.data(), path.size(), current, held)) {
+                path.clear(); // resized meanwhile, the path is meaningless now
+                stash_next = false;
+                continue;
+            }
+            each_table([&](int table) {
+                settle(*current, table, location.index[table]);
+            });
+            for (const CuckooStep& step : path) {
+                settle(*current, step.table, step.index);
+            }
+            int way;
+            int present = find(*current, location, key, way);
+            if (present >= 0) {
+                found(current->bucket(present, location.index[present]).keys[way]);
+            }
+            if (present >= 0 || stash.visit(key, found)) {
+                locks.unlock(held);
+                help_drain();
+                return false;
+            }
+            int table = least_loaded(*current, location);
+            if (table >= 0) {
+                push(current->bucket(table, location.index[table]), make(), location.tag);
+                count_change(location.index[0], 1);
+                locks.unlock(held);
+                help_drain();
+                return true;
+            }
+            if (!path.empty() && path_valid(*current, location, path)) {
+                apply_path(*current, path, make(), location.tag);
+                count_change(location.index[0], 1);
+                locks.unlock(held);
+                help_drain();
+                return true;
+            }
+            if (stash_next) {
+                stash.lock();
+                bool stashed = stash.size() < STASH_SLOTS && stash.insert(make()); // make() only with a slot free
+                stash.unlock();
+                if (stashed) {
+                    count_change(location.index[0], 1);
+                }
+                locks.unlock(held);
+                if (stashed) {
+                    counters.stashed();
+                    help_drain();
+                    return true;
+                }
+                resize(current); // no cuckoo path and the stash is full, the table is too full
+                path.clear(); // a rebuild without locks searches paths in the same scratch space
+                stash_next = false;
+                continue;
+            }
+            locks.unlock(held);
+            if (max_load_factor < 1 && load_of(*current) > max_load_factor) {
+                resize(current); // full enough to grow before searching paths
+                path.clear();
+                continue;
+            }
+            path_tables = current;
+            if (!search_path(location, current, path)) {
+                counters.failed_search();
+                path.clear();
+                stash_next = true; // stashed once the candidate stripes are held again
+            }
+        }
+    }
+
+    // function to call found(value) on the value equal to key, or else store make() where one
+    // of its buckets has a free way, without locks and never displacing values
+    template <class K, class Found, class Make>
+    InPlace in_place_or_visit(const K& key, Found&& found, Make&& make, const Located* known = nullptr) {
+        Tables& current = *tables.load();
+        Location location = locate_known(key, &current, known);
+        int way;
+        int present = find(current, location, key, way);
+        if (present >= 0) {
+            found(current.bucket(present, location.index[present]).keys[way]);
+        }
+        if (present >= 0 || stash.visit(key, found)) {
+            return InPlace::PRESENT;
+        }
+        int table = least_loaded(current, location);
+        if (table < 0) {
+            return InPlace::FULL;
+        }
+        push(current.bucket(table, location.index[table]), make(), location.tag);
+        count_change(location.index[0], 1);
+        return InPlace::ADDED;
+    }
+
+    // function to call f(value) on the value equal to key under the locks of its bucket, so
+    // f may change it in place as long as its hash and equality stay the same. false if
+    // there is no such value
+    template <class K, class F>
+    bool visit(const K& key, F&& f) {
+        Stripes held;
+        Location location;
+        Tables* current = lock_candidates(key, location, held);
+        int way;
+        int table = find(*current, location, key, way);
+        if (table >= 0) {
+            f(current->bucket(table, location.index[table]).keys[way]);
+        }
+        bool found = table >= 0 || stash.visit(key, f);
+        locks.unlock(held);
+        return found;
+    }
+
+    // function to call read(value) on the value equal to key, the way contains finds it: with
+    // locks and a trivially copyable value without taking any, in which case read may run
+    // more than once and only its last call saw a consistent value. false if there is none
+    template <class K, class F>
+    bool read(const K& key, F&& read_value) {
+        counters.lookup();
+        if constexpr (!CONCURRENT) {
+            Tables& current = *tables.load();
+            Location location = locate(key, current);
+            int way;
+            int table = find(current, location, key, way);
+            counters.probed(table >= 0 ? table + 1 : NumTables);
+            if (table >= 0) {
+                read_value(current.bucket(table, location.index[table]).keys[way]);
+                return true;
+            }
+            return !stash.empty() && stash.visit(key, read_value);
+        } else if constexpr (!std::is_trivially_copyable<T>::value) {
+            counters.probed(NumTables);
+            return visit(key, read_value);
+        } else {
+            ReadPin pin;
+            for (;;) {
+                Tables* current = tables.load(std::memory_order_acquire);
+                bool found;
+                if (try_probe(current, key, locate(key, *current), found, read_value)) { // the seed may differ between retries
+                    return found;
+                }
+                cpu_relax(); // a writer held one of the stripes
+            }
+        }
+    }
+
+    // locks kept on behalf of a caller holding a pointer to a value: the stripes of its
+    // candidate buckets, and the stash when the value is stashed. writers to those buckets
+    // wait until the guard is released, so the set must not be used by the same thread
+    // meanwhile. a shared guard takes the locks without their versions, so lock-free readers
+    // keep going; an exclusive one makes them retry until it is released, which lets its
+    // holder change the value
+    class EntryGuard {
+        CuckooSet* owner = nullptr;
+        Stripes held;
+        bool stash_held = false;
+        bool shared = false;
+        T* entry = nullptr;
+
+        friend class CuckooSet;
+
+    public:
+        EntryGuard() = default;
+
+        EntryGuard(EntryGuard&& other) noexcept
+                : owner(other.owner), held(other.held), stash_held(other.stash_held), shared(other.shared),
+                  entry(other.entry) {
+            other.owner = nullptr;
+            other.entry = nullptr;
+        }
+
+        EntryGuard& operator=(EntryGuard&& other) noexcept {
+            if (this != &other) {
+                release();
+                owner = other.owner;
+                held = other.held;
+                stash_held = other.stash_held;
+                shared = other.shared;
+                entry = other.entry;
+                other.owner = nullptr;
+                other.entry = nullptr;
+            }
+            return *this;
+        }
+
+        ~EntryGuard() {
+            release();
+        }
+
+        // function to get the guarded value, nullptr if there was none
+        T* get() const {
+            return entry;
+        }
+
+        // function to release the locks early, the value must not be used afterwards
+        void release() {
+            if (owner != nullptr) {
+                if (stash_held && shared) {
+                    owner->stash.reader_lock().unlock();
+                } else if (stash_held) {
+                    owner->stash.unlock();
+                }
+                if (shared) {
+                    owner->locks.unlock_readers(held);
+                } else {
+                    owner->locks.unlock(held);
+                }
+                owner = nullptr;
+                entry = nullptr;
+            }
+        }
+    };
+
+    // function to find the value equal to key and keep its bucket locked, an empty guard if
+    // there is no such value. shared keeps writers out without disturbing lock-free readers,
+    // and the value must then be left unchanged
+    template <class K>
+    EntryGuard guard_entry(const K& key, bool shared = false) {
+        EntryGuard guard;
+        guard.owner = this;
+        guard.shared = shared;
+        Location location;
+        Tables* current;
+        if (shared) {
+            current = lock_candidates_shared(key, location, guard.held);
+        } else {
+            current = lock_candidates(key, location, guard.held);
+        }
+        int way;
+        int table = find(*current, location, key, way);
+        if (table >= 0) {
+            guard.entry = &current->bucket(table, location.index[table]).keys[way];
+        } else if (shared) {
+            // a shared guard does not drain, the value may still sit in the old bucket feeding
+            // a candidate; that bucket shares the candidate's stripe, so once the value is
+            // found there it cannot be drained (nor the old buckets retired) before the release
+            ReadPin pin;
+            Tables* from = old_tables.load(std::memory_order_acquire);
+            if (from != nullptr && from->successor == current) {
+                first_table([&](int table) {
+                    TableBucket& bucket = from->bucket(table, location.index[table] & (from->capacity - 1));
+                    int found = bucket.find(location.tag, key);
+                    if (found >= 0) {
+                        guard.entry = &bucket.keys[found];
+                    }
+                    return found >= 0;
+                });
+            }
+        }
+        if (guard.entry == nullptr && !stash.empty()) {
+            if (shared) {
+                stash.reader_lock().lock();
+            } else {
+                stash.lock();
+            }
+            guard.stash_held = true;
+            int slot = stash.find(key);
+            if (slot >= 0) {
+                guard.entry = &stash.at(slot);
+            }
+        }
+        if (guard.entry == nullptr) {
+            guard.release();
+        }
+        return guard;
+    }
+
+    // function to remove the value equal to key, calling erased(value) on it under the locks
+    // of its bucket just before it goes. false if there is no such value. known is the
+    // location of key computed ahead, if any
+    template <class K, class F>
+    bool remove_and_visit(const K& key, F&& erased, const Located* known = nullptr) {
+        Stripes held;
+        Location location;
+        Tables* current = lock_candidates(key, location, held, known);
+        int way;
+        int table = find(*current, location, key, way);
+        bool removed = table >= 0;
+        if (removed) {
+            TableBucket& bucket = current->bucket(table, location.index[table]);
+            erased(bucket.keys[way]);
+            bucket.erase(way);
+        } else if (!stash.empty()) {
+            stash.lock();
+            int slot = stash.find(key);
+            if (slot >= 0) {
+                erased(stash.at(slot));
+                stash.erase(slot);
+                removed = true;
+            }
+            stash.unlock();
+        }
+        if (removed) {
+            count_change(location.index[0], -1);
+        }
+        locks.unlock(held);
+        help_drain();
+        return removed;
+    }
+
+    // function to run f() with every writer stopped and no resize in progress, so the values
+    // only change from inside f; lookups keep going
+    template <class F>
+    void with_writers_stopped(F&& f) {
+        stop_writers();
+        f();
+        locks.unlock_all();
+    }
+
+    // function to call f(value) on every value, the tables and then the stash. the caller
+    // stops the writers, with with_writers_stopped
+    template <class F>
+    void for_each_value(F&& f) {
+        for (const TableBucket& bucket : tables.load(std::memory_order_relaxed)->buckets) {
+            for (uint32_t ways = ~bucket.empty_ways() & TableBucket::ALL_WAYS; ways != 0; ways &= ways - 1) {
+                f(bucket.keys[__builtin_ctz(ways)]);
+            }
+        }
+        for (int slot = 0; slot < STASH_SLOTS; slot++) {
+            T val;
+            if (stash.copy_slot(slot, val)) {
+                f(val);
+            }
+        }
+    }
+
+private:
+    // function to add a value, moved into its way when it is an rvalue; it is only
+    // consumed once it is stored. known is its location computed ahead, if any, which the
+    // combiner does not need
+    template <class V>
+    bool add_value(V&& val, const Located* known = nullptr) {
+        if constexpr (CONCURRENT) {
+            if (combining.load(std::memory_order_relaxed)) {
+                return combine(val, &combined_add<V>, &val);
+            }
+        }
+        return add_direct(std::forward<V>(val), known);
+    }
+
+    // function to add a value with the stripe locks, in place of the combiner or on its behalf
+    template <class V>
+    bool add_direct(V&& val, const Located* known = nullptr) {
+        return insert_or_visit(val, [](const T&) {}, [&val]() -> V&& {
+            return std::forward<V>(val);
+        }, known);
+    }
+
+    // function to add a value only when one of its buckets has a free way, without locks
+    template <class V>
+    InPlace add_in_place_value(V&& val) {
+        return in_place_or_visit(val, [](const T&) {}, [&val]() -> V&& {
+            return std::forward<V>(val);
+        });
+    }
+
+    // function to remove a value, or the value equal to a key of a transparent hash policy
+    template <class K>
+    bool remove_key(const K& val, const Located* known = nullptr) {
+        if constexpr (CONCURRENT) {
+            if (combining.load(std::memory_order_relaxed)) {
+                return combine(val, &combined_remove<K>, &val);
+            }
+        }
+        return remove_direct(val, known);
+    }
+
+    // function to remove a value with the stripe locks, in place of the combiner or on its behalf
+    template <class K>
+    bool remove_direct(const K& val, const Located* known = nullptr) {
+        return remove_and_visit(val, [](const T&) {}, known);
+    }
+
+    // requests a combiner runs: the argument is the value or key of the requester, which
+    // waits for the result, so an rvalue passed to add can still be moved from
+    template <class V>
+    static bool combined_add(CuckooSet& set, const void* arg) {
+        using Value = typename std::remove_reference<V>::type;
+        return set.add_direct(std::forward<V>(*const_cast<Value*>(static_cast<const Value*>(arg))));
+    }
+
+    template <class K>
+    static bool combined_remove(CuckooSet& set, const void* arg) {
+        return set.remove_direct(*static_cast<const K*>(arg));
+    }
+
+    // function to apply the requests published in the combining slots, the caller holds the
+    // combiner lock. each pass hashes and prefetches the candidate buckets of every pending
+    // request before applying the first, so their cache misses overlap; the combiner is the
+    // only writer taking the stripes unless some writers bypass it, so they are uncontended
+    void combine_pending() {
+        int batch[COMBINING_SLOTS];
+        for (int pass = 0; pass < COMBINING_PASSES; pass++) {
+            int count = 0;
+            int used = combining_used.load(std::memory_order_acquire);
+            for (int i = 0; i < used; i++) {
+                if (combining_slots[i].state.load(std::memory_order_acquire) == SLOT_PENDING) {
+                    batch[count++] = i;
+                }
+            }
+            if (count == 0) {
+                return;
+            }
+            Tables* current = tables.load(std::memory_order_acquire);
+            for (int i = 0; i < count; i++) {
+                uint64_t val_hash = combining_slots[batch[i]].hash;
+                each_table([&](int table) {
+                    current->bucket(table, index_of(val_hash, table, *current)).prefetch_for_write();
+                });
+            }
+            for (int i = 0; i < count; i++) {
+                CombiningSlot& slot = combining_slots[batch[i]];
+                slot.result = slot.run(*this, slot.arg);
+                slot.state.store(SLOT_DONE, std::memory_order_release);
+            }
+        }
+    }
+
+    // function to have run(*this, arg) applied by a combiner: the request is published in a
+    // slot, then the caller waits until some combiner marks it done, taking the combiner
+    // role itself whenever it is free
+    template <class K>
+    bool combine(const K& key, bool (*run)(CuckooSet&, const void*), const void* arg) {
+        static std::atomic<unsigned> next_thread{0};
+        static thread_local unsigned thread_index = next_thread.fetch_add(1, std::memory_order_relaxed);
+        CombiningSlot* slot;
+        for (unsigned i = thread_index;; i++) { // the slot of the thread, or the next free one
+            int index = static_cast<int>(i % COMBINING_SLOTS);
+            slot = &combining_slots[index];
+            int free = SLOT_FREE;
+            if (slot->state.load(std::memory_order_relaxed) == SLOT_FREE
+                    && slot->state.compare_exchange_strong(free, SLOT_CLAIMED, std::memory_order_acquire)) {
+                int used = combining_used.load(std::memory_order_relaxed);
+                while (used <= index && !combining_used.compare_exchange_weak(used, index + 1)) {
+                }
+                break;
+            }
+            if ((i - thread_index) % COMBINING_SLOTS == COMBINING_SLOTS - 1) {
+                std::this_thread::yield(); // more threads than slots, all taken
+            }
+        }
+        slot->run = run;
+        slot->arg = arg;
+        slot->hash = hash(key, *tables.load(std::memory_order_acquire));
+        slot->state.store(SLOT_PENDING, std::memory_order_release);
+        for (unsigned spins = 0; slot->state.load(std::memory_order_acquire) != SLOT_DONE; spins++) {
+            if (combiner.try_lock()) {
+                combine_pending();
+                combiner.unlock();
+            } else if (spins < COMBINING_SPINS) {
+                cpu_relax();
+            } else {
+                std::this_thread::yield(); // the combiner may have been preempted
+            }
+        }
+        bool result = slot->result;
+        slot->state.store(SLOT_FREE, std::memory_order_release);
+        return result;
+    }
+
+    // function to check for a value, or the value equal to a key of a transparent hash policy
+    template <class K>
+    bool contains_key(const K& val) {
+        return read(val, [](const T&) {});
+    }
+
+public:
+    // constructor, initial_capacity is the number of values each table should hold before
+    // the first resize. the buckets of a table are rounded up to a power of two; with locks
+    // also to at least the number of lock stripes (itself rounded up to a power of two and
+    // fixed as the tables grow), so a stripe guards the same buckets in the old and the new
+    // tables while a resize drains
+    CuckooSet(int initial_capacity, int lock_stripes = DEFAULT_LOCK_STRIPES)
+            : locks(lock_stripes), count_shards(CONCURRENT ? locks.size() : COUNT_SHARDS),
+              counts(new CountShard[count_shards]) {
+        int bucket_count = std::max(1, (initial_capacity + BucketWays - 1) / BucketWays);
+        int capacity = 1;
+        while (capacity < bucket_count || capacity < static_cast<int>(locks.size())) {
+            capacity <<= 1;
+        }
+        generations.emplace_back(new Tables(capacity, INITIAL_HASH_SEED, 0));
+        tables.store(generations.back().get(), std::memory_order_relaxed);
+        if (CONCURRENT) {
+            combining_slots.reset(new CombiningSlot[COMBINING_SLOTS]);
+        }
+    }
+
+    // destructor to clean up resources
+    ~CuckooSet() {
+        generations.clear();
+    }
+
+    // function to add a value to the set
+    bool add(const T& val) {
+        return add_value(val);
+    }
+
+    // function to add a value to the set, moving it into its way
+    bool add(T&& val) {
+        return add_value(std::move(val));
+    }
+
+    // function to add a value built in place from args, which is moved into its way
+    template <class... Args>
+    bool emplace(Args&&... args) {
+        return add_value(T(std::forward<Args>(args)...));
+    }
+
+    // function to add a value only when one of its buckets has a free way. it never displaces
+    // values or allocates, so it can run inside an atomic transaction; only without locks
+    InPlace add_in_place(const T& val) {
+        static_assert(!CONCURRENT, "add_in_place is only available without locks");
+        return add_in_place_value(val);
+    }
+
+    InPlace add_in_place(T&& val) {
+        static_assert(!CONCURRENT, "add_in_place is only available without locks");
+        return add_in_place_value(std::move(val));
+    }
+
+    // function to remove a value from the set
+    bool remove(const T& val) {
+        return remove_key(val);
+    }
+
+    // function to remove the value equal to a key of another type, without building a value
+    // from it; only when the hash policy is transparent
+    template <class K, class H = Hash, class = typename H::is_transparent>
+    bool remove(const K& key) {
+        return remove_key(key);
+    }
+
+    // function to check if a value is in the set. with locks, for trivially copyable values
+    // no lock is taken: the probe is retried until the versions of the candidate stripes are
+    // even and unchanged around it and the tables were not replaced meanwhile. while a resize
+    // drains, the old bucket feeding each candidate is probed too; it shares the candidate's
+    // stripe, so a value moving between them is caught by the same versions. other values
+    // could be torn mid-copy, so they are read under the locks
+    bool contains(const T& val) {
+        return contains_key(val);
+    }
+
+    // function to check for the value equal to a key of another type, without building a
+    // value from it (a std::string_view in a set of std::string); only when the hash policy
+    // is transparent
+    template <class K, class H = Hash, class = typename H::is_transparent>
+    bool contains(const K& key) {
+        return contains_key(key);
+    }
+
+    // function to set the load factor past which the tables grow before an insert searches a
+    // cuckoo path, between MIN_LOAD_TO_GROW and 1 (the default, growing only when no path is
+    // found); lower trades memory for shorter inserts
+    void set_max_load_factor(double load) {
+        max_load_factor = std::max(MIN_LOAD_TO_GROW, std::min(load, 1.0));
+    }
+
+    // function to choose how adds and removes take the stripe locks. with combining on, a
+    // writer publishes its request in a slot instead, and one thread at a time, the
+    // combiner, applies every published request, so under heavy writes the stripes, the
+    // count shards and a resize are handled by one thread rather than fought over. lookups
+    // are unaffected. it can be switched at any time, the two kinds of writers mix safely;
+    // only with locks
+    void set_combining(bool on) {
+        static_assert(CONCURRENT, "combining is only available with locks");
+        combining.store(on, std::memory_order_relaxed);
+    }
+
+    // function to set the most worker threads a rebuild or bulk load may use, 1 rehashes on
+    // the calling thread only
+    void set_rehash_threads(int threads) {
+        rehash_threads = std::max(1, threads);
+    }
+
+    // function to add every value of [first, last) at once, returns how many were new, on
+    // up to num_threads workers (0 for the set_rehash_threads limit). when the current
+    // tables have room for the whole load the values are added to them in place, with locks
+    // each worker adding its slice like any writer. otherwise the values are hashed and
+    // partitioned by bucket, and the workers fill new tables sized for the whole load without
+    // any per-value locking; the finished tables then replace the current ones in one step,
+    // with locks writers wait for the whole load while readers keep using the old tables
+    template <class Iterator>
+    size_t bulk_load(Iterator first, Iterator last, int num_threads = 0) {
+        size_t count = std::distance(first, last);
+        int most_workers = num_threads > 0 ? num_threads : rehash_threads;
+        Tables& current = stop_writers();
+        size_t values = counted_values() + count;
+        int capacity = current.capacity;
+        while (values > MIN_LOAD_TO_GROW * NumTables * BucketWays * capacity) {
+            capacity *= 2;
+        }
+        if (capacity == current.capacity) {
+            locks.unlock_all();
+            return add_range(first, last, most_workers);
+        }
+        return rebuild_exclusive(current, capacity, first, last, most_workers);
+    }
+
+    // function to make room for n values in all, so that adding up to n grows no table
+    void reserve(size_t n) {
+        Tables& current = stop_writers();
+        int capacity = current.capacity;
+        while (n > MIN_LOAD_TO_GROW * NumTables * BucketWays * capacity) {
+            capacity *= 2;
+        }
+        if (capacity == current.capacity) {
+            locks.unlock_all();
+            return;
+        }
+        rebuild_exclusive(current, capacity, static_cast<const T*>(nullptr), static_cast<const T*>(nullptr), rehash_threads);
+    }
+
+    // function to give back memory after many removes: the tables are rebuilt at the
+    // smallest capacity the values fit below MIN_LOAD_TO_GROW, never below the number of lock
+    // stripes, and the headers of the replaced generations are freed. with locks no other
+    // thread may use the set during the call, since a writer could still hold one of them
+    void shrink_to_fit() {
+        Tables& current = stop_writers();
+        size_t values = counted_values();
+        int capacity = 1;
+        while (capacity < static_cast<int>(locks.size()) || values > MIN_LOAD_TO_GROW * NumTables * BucketWays * capacity) {
+            capacity <<= 1;
+        }
+        if (capacity < current.capacity) {
+            rebuild_exclusive(current, capacity, static_cast<const T*>(nullptr), static_cast<const T*>(nullptr), rehash_threads);
+        } else {
+            locks.unlock_all();
+        }
+        generations.erase(generations.begin(), generations.end() - 1);
+        if (generations.back()->buckets.owns()) {
+            mapping.reset(); // every value migrated to the heap
+        }
+    }
+
+    // function to write an image of the set to path (see snapshot.h) that open_mapped can
+    // serve without rebuilding anything; only for trivially copyable values, and the image
+    // only opens in a set of the same type and hash policy. writers wait for the whole write,
+    // readers keep going. false if the file could not be written
+    bool save(const std::string& path) {
+        static_assert(std::is_trivially_copyable<T>::value, "only sets of trivially copyable values can be saved");
+        Tables& current = stop_writers();
+        std::vector<T> stashed;
+        for (int slot = 0; slot < STASH_SLOTS; slot++) {
+            T val;
+            if (stash.copy_slot(slot, val)) {
+                stashed.push_back(val);
+            }
+        }
+        size_t bucket_bytes = current.buckets.size() * sizeof(TableBucket);
+        size_t stashed_bytes = stashed.size() * sizeof(T);
+        SnapshotHeader header = {};
+        header.magic = SNAPSHOT_MAGIC;
+        header.version = SNAPSHOT_VERSION;
+        header.header_size = sizeof(SnapshotHeader);
+        header.num_tables = NumTables;
+        header.bucket_ways = BucketWays;
+        header.value_size = sizeof(T);
+        header.bucket_size = sizeof(TableBucket);
+        header.capacity = current.capacity;
+        header.seed = current.seed;
+        header.reseeds = current.reseeds;
+        header.stashed = stashed.size();
+        header.values = counted_values();
+        header.probe_hash = hasher(T(), current.seed);
+        header.checksum = snapshot_checksum(current.buckets.begin(), bucket_bytes, stashed.data(), stashed_bytes);
+        bool written = write_snapshot(path, header, current.buckets.begin(), bucket_bytes, stashed.data(), stashed_bytes);
+        locks.unlock_all();
+        return written;
+    }
+
+    // function to replace the contents of the set by an image written by save. the file is
+    // mapped privately and the tables are laid over it: lookups read the mapped buckets
+    // directly, pages load from the file as they are first touched, and a write copies the
+    // page it lands on into memory of its own, leaving the file unchanged; a resize moves the
+    // values into heap tables as usual. with verify the checksum is checked first, which
+    // reads the whole file once. no other thread may use the set during the call. false,
+    // with the set unchanged, if the file is missing, damaged, written by another type of
+    // set or hash policy, or has fewer buckets per table than there are lock stripes
+    bool open_mapped(const std::string& path, bool verify = true) {
+        static_assert(std::is_trivially_copyable<T>::value, "only sets of trivially copyable values can be mapped");
+        std::unique_ptr<MappedFile> file(new MappedFile());
+        if (!file->map(path) || file->size() < SNAPSHOT_DATA_OFFSET) {
+            return false;
+        }
+        SnapshotHeader header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION
+                || header.header_size != sizeof(SnapshotHeader) || header.num_tables != NumTables
+                || header.bucket_ways != BucketWays || header.value_size != sizeof(T)
+                || header.bucket_size != sizeof(TableBucket) || header.stashed > STASH_SLOTS
+                || header.capacity < locks.size() || header.capacity > (1u << 30)
+                || (header.capacity & (header.capacity - 1)) != 0) {
+            return false;
+        }
+        size_t bucket_bytes = NumTables * header.capacity * sizeof(TableBucket);
+        size_t stashed_bytes = header.stashed * sizeof(T);
+        TableBucket* buckets = reinterpret_cast<TableBucket*>(file->data() + SNAPSHOT_DATA_OFFSET);
+        const char* stashed = file->data() + SNAPSHOT_DATA_OFFSET + bucket_bytes;
+        if (file->size() != SNAPSHOT_DATA_OFFSET + bucket_bytes + stashed_bytes
+                || header.probe_hash != hasher(T(), header.seed)
+                || (verify && header.checksum != snapshot_checksum(buckets, bucket_bytes, stashed, stashed_bytes))) {
+            return false;
+        }
+        stop_writers();
+        generations.clear();
+        generations.emplace_back(new Tables(header.capacity, header.seed, header.reseeds, buckets));
+        tables.store(generations.back().get(), std::memory_order_release);
+        mapping = std::move(file);
+        stash.lock();
+        stash.clear();
+        for (uint32_t i = 0; i < header.stashed; i++) {
+            T val;
+            std::memcpy(&val, stashed + i * sizeof(T), sizeof(T));
+            stash.insert(val);
+        }
+        stash.unlock();
+        reset_count(header.values);
+        locks.unlock_all();
+        return true;
+    }
+
+    // function to set how many keys the batched operations hash and prefetch before probing
+    void set_batch_size(int size) {
+        batch_size = std::max(1, std::min(size, MAX_BATCH_SIZE));
+    }
+
+    // function to check a group of values, out[i] tells whether keys[i] is in the set. each
+    // group of batch_size keys is hashed and every candidate bucket of every key prefetched
+    // before the first probe, so the cache misses of a group overlap instead of queueing up
+    void contains_batch(const T* keys, size_t n, bool* out) {
+        Located located[MAX_BATCH_SIZE];
+        if constexpr (CONCURRENT && !std::is_trivially_copyable<T>::value) {
+            for (size_t start = 0; start < n; start += batch_size) {
+                size_t count = std::min(static_cast<size_t>(batch_size), n - start);
+                prefetch_group(keys + start, count, false, located);
+                for (size_t i = 0; i < count; i++) {
+                    out[start + i] = contains(keys[start + i]); // probed under the locks
+                }
+            }
+            return;
+        }
+        for (size_t start = 0; start < n; start += batch_size) {
+            size_t count = std::min(static_cast<size_t>(batch_size), n - start);
+            ReadPin pin;
+            Tables* current = prefetch_group(keys + start, count, false, located);
+            for (size_t i = 0; i < count; i++) {
+                if (try_probe(current, keys[start + i], located[i].location, out[start + i], [](const T&) {})) {
+                    counters.lookup();
+                } else {
+                    out[start + i] = contains(keys[start + i]); // raced with a writer or a resize
+                }
+            }
+        }
+    }
+
+    // function to add a group of values, out[i] (unless out is nullptr) tells whether keys[i]
+    // was added. like contains_batch, each group is hashed and prefetched first, then every
+    // add starts from the location computed for it unless the tables changed meanwhile
+    void add_batch(const T* keys, size_t n, bool* out = nullptr) {
+        Located located[MAX_BATCH_SIZE];
+        for (size_t start = 0; start < n; start += batch_size) {
+            size_t count = std::min(static_cast<size_t>(batch_size), n - start);
+            prefetch_group(keys + start, count, true, located);
+            for (size_t i = 0; i < count; i++) {
+                bool added = add_value(keys[start + i], &located[i]);
+                if (out != nullptr) {
+                    out[start + i] = added;
+                }
+            }
+        }
+    }
+
+    // function to remove a group of values, out[i] (unless out is nullptr) tells whether
+    // keys[i] was removed, reusing the locations of the group as add_batch does
+    void remove_batch(const T* keys, size_t n, bool* out = nullptr) {
+        Located located[MAX_BATCH_SIZE];
+        for (size_t start = 0; start < n; start += batch_size) {
+            size_t count = std::min(static_cast<size_t>(batch_size), n - start);
+            prefetch_group(keys + start, count, true, located);
+            for (size_t i = 0; i < count; i++) {
+                bool removed = remove_key(keys[start + i], &located[i]);
+                if (out != nullptr) {
+                    out[start + i] = removed;
+                }
+            }
+        }
+    }
+
+    // function to get the number of elements in the set, exact: with locks every writer is
+    // stopped for the moment it takes to add up the count shards
+    int size() {
+        locks.lock_all();
+        size_t values = counted_values();
+        locks.unlock_all();
+        return static_cast<int>(values);
+    }
+
+    // function to get the number of elements without stopping anyone, exact once writers are
+    // quiet and otherwise off by at most the operations in flight
+    size_t approximate_size() const {
+        return counted_values();
+    }
+
+    // function to read the hot-path counters, lock counters included, all zero unless
+    // CUCKOO_STATS is defined. the load factor is over the ways of the current tables
+    CuckooStats stats() {
+        CuckooStats snapshot = counters.snapshot();
+        snapshot += locks.stats();
+        Tables* current = tables.load(std::memory_order_acquire);
+        snapshot.load_factor = static_cast<double>(approximate_size()) / (current->buckets.size() * BucketWays);
+        return snapshot;
+    }
+
+    // function to populate the set with a list of entries, added in groups by add_batch so
+    // the cache misses of a group overlap
+    bool populate(const std::vector<T>& entries) {
+        std::unique_ptr<bool[]> added(new bool[entries.size()]);
+        add_batch(entries.data(), entries.size(), added.get());
+        return std::all_of(added.get(), added.get() + entries.size(), [](bool was_added) {
+            return was_added; // false if any duplicate entry is found
+        });
+    }
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "aligned_allocator.h"
+
+// epoch-based reclamation for the sets read without locks. memory unlinked from a shared
+// structure is retired instead of freed: a thread pins the current epoch for the length of
+// each operation, the epoch only advances once every pinned thread has seen it, and memory
+// retired in epoch e is freed once the epoch reaches e + 2, when no thread can still hold
+// a pointer it loaded before the unlink. one domain serves every set of the process
+class EpochDomain {
+    static constexpr uint64_t ACTIVE = 1;
+    // retired objects a thread gathers before it tries to advance the epoch and free some
+    static constexpr size_t COLLECT_EVERY = 64;
+
+    struct Retired {
+        void* object;
+        void (*destroy)(void*);
+        uint64_t epoch;
+    };
+
+    // state of one thread, recycled once the thread exits; its retired objects wait for the
+    // next owner
+    struct alignas(CACHE_LINE_SIZE) Record {
+        std::atomic<uint64_t> state{0}; // pinned epoch << 1 | ACTIVE, or 0
+        std::atomic<bool> in_use{true};
+        Record* next = nullptr;
+        int depth = 0;                  // nested pins, owner only
+        std::vector<Retired> retired;   // owner only
+    };
+
+    // releases the record of a thread when it exits
+    struct Owner {
+        Record* record = nullptr;
+
+        ~Owner() {
+            if (record != nullptr) {
+                record->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<uint64_t> epoch{1};
+    std::atomic<Record*> records{nullptr};
+
+    // function to get the record of the calling thread, claiming a free one or adding one
+    Record& local() {
+        static thread_local Owner owner;
+        if (owner.record == nullptr) {
+            for (Record* record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+                bool free = false;
+                if (!record->in_use.load(std::memory_order_relaxed)
+                        && record->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                    owner.record = record;
+                    return *record;
+                }
+            }
+            Record* record = new Record();
+            record->next = records.load(std::memory_order_relaxed);
+            while (!records.compare_exchange_weak(record->next, record, std::memory_order_release)) {
+            }
+            owner.record = record;
+        }
+        return *owner.record;
+    }
+
+    // function to advance the epoch unless a pinned thread has not seen it yet
+    void try_advance() {
+        uint64_t current = epoch.load(std::memory_order_seq_cst);
+        for (Record* record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            uint64_t state = record->state.load(std::memory_order_seq_cst);
+            if ((state & ACTIVE) && (state >> 1) != current) {
+                return;
+            }
+        }
+        epoch.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst);
+    }
+
+    // function to free what a record retired at least two epochs ago
+    void collect(Record& record) {
+        uint64_t current = epoch.load(std::memory_order_acquire);
+        size_t kept = 0;
+        for (Retired& retired : record.retired) {
+            if (retired.epoch + 2 <= current) {
+                retired.destroy(retired.object);
+            } else {
+                record.retired[kept++] = retired;
+            }
+        }
+        record.retired.resize(kept);
+    }
+
+public:
+    EpochDomain() = default;
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    // destructor, at exit every thread is gone and everything retired can be freed
+    ~EpochDomain() {
+        Record* record = records.load(std::memory_order_acquire);
+        while (record != nullptr) {
+            for (Retired& retired : record->retired) {
+                retired.destroy(retired.object);
+            }
+            Record* next = record->next;
+            delete record;
+            record = next;
+        }
+    }
+
+    // function to get the domain of the process
+    static EpochDomain& global() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    // function to pin the current epoch for the calling thread, pins nest
+    void enter() {
+        Record& record = local();
+        if (record.depth++ == 0) {
+            record.state.store(epoch.load(std::memory_order_relaxed) << 1 | ACTIVE, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // the pin is visible before any load it protects
+        }
+    }
+
+    // function to unpin, once the outermost pin is released
+    void leave() {
+        Record& record = local();
+        if (--record.depth == 0) {
+            record.state.store(0, std::memory_order_release);
+        }
+    }
+
+    // function to retire an object already unlinked by the calling thread, destroy(object)
+    // runs once no thread can reach it
+    void retire(void* object, void (*destroy)(void*)) {
+        Record& record = local();
+        record.retired.push_back(Retired{object, destroy, epoch.load(std::memory_order_seq_cst)});
+        if (record.retired.size() % COLLECT_EVERY == 0) {
+            try_advance();
+            collect(record);
+        }
+    }
+
+    // function to retire an object allocated with new
+    template <class U>
+    void retire(U* object) {
+        retire(object, [](void* unlinked) {
+            delete static_cast<U*>(unlinked);
+        });
+    }
+
+    // function to free what the calling thread retired as soon as no pinned thread can still
+    // reach it, instead of waiting for COLLECT_EVERY more retires; for large objects. with no
+    // thread pinned the epoch advances twice and everything goes at once. what threads that
+    // exited since left behind is collected too
+    void reclaim() {
+        try_advance();
+        try_advance();
+        collect(local());
+        for (Record* record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            bool free = false;
+            if (!record->in_use.load(std::memory_order_relaxed)
+                    && record->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                collect(*record);
+                record->in_use.store(false, std::memory_order_release);
+            }
+        }
+    }
+};
+
+// pin of the current epoch for the lifetime of a scope
+class EpochGuard {
+    EpochDomain& domain;
+
+public:
+    explicit EpochGuard(EpochDomain& domain) : domain(domain) {
+        domain.enter();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+    ~EpochGuard() {
+        domain.leave();
+    }
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "concurrent.h"
+#include "cuckoo_filter.h"
+
+// concurrent cuckoo set behind a cuckoo filter of its values: contains asks the filter first
+// and only probes the tables when the filter reports the value, so most misses cost two
+// bucket reads of a few bits per value instead of a probe of both full-value tables.
+//
+// the filter is changed under the stripes of the value in the set: an add puts the
+// fingerprint in just before the value is stored (only when it is really stored, so a
+// duplicate never reaches the filter) and a remove takes it out just before the value goes.
+// a filter too full for an add is marked overflowed, which sends lookups straight to the
+// set, and the add then replaces it, with every writer stopped, by one built from the values
+// with twice the slots. lookups may still be reading a replaced filter, which stays alive
+// until shrink_to_fit
+template <class T, class Hash = DefaultHash<T>, int FingerprintBits = 12>
+class CuckooFilteredSet : private CuckooConcurrentHashSet<T, Hash> {
+    using Set = CuckooConcurrentHashSet<T, Hash>;
+    using Filter = CuckooConcurrentFilter<T, FingerprintBits, Hash>;
+
+    std::atomic<Filter*> filter;
+    std::vector<std::unique_ptr<Filter>> filters; // the current one last
+    // an add found the filter full: until it is replaced lookups skip it and removes leave
+    // it alone
+    std::atomic<bool> overflowed{false};
+
+    void start_filter(size_t expected_values) {
+        filters.emplace_back(new Filter(expected_values));
+        filter.store(filters.back().get());
+    }
+
+    template <class V>
+    bool add_value(V&& val) {
+        bool added = Set::insert_or_visit(val, [](const T&) {}, [this, &val]() -> V&& {
+            // the filter is only replaced with every writer stopped, not while we hold stripes
+            if (!overflowed.load(std::memory_order_relaxed) && !filter.load(std::memory_order_relaxed)->add(val)) {
+                overflowed.store(true);
+            }
+            return std::forward<V>(val);
+        });
+        if (overflowed.load(std::memory_order_relaxed)) {
+            grow_filter();
+        }
+        return added;
+    }
+
+    // function to replace an overflowed filter by one holding every value, with twice the
+    // slots
+    void grow_filter() {
+        Set::with_writers_stopped([this] {
+            if (!overflowed.load(std::memory_order_relaxed)) {
+                return; // another add replaced it first
+            }
+            // keys for twice the slots at 90% load, or for every value if there are more
+            size_t expected = std::max<size_t>(filter.load()->slots() * 2 * 9 / 10, Set::approximate_size());
+            for (;;) {
+                std::unique_ptr<Filter> grown(new Filter(expected));
+                bool complete = true;
+                Set::for_each_value([&](const T& val) {
+                    complete = complete && grown->add(val);
+                });
+                if (complete) {
+                    filters.push_back(std::move(grown));
+                    filter.store(filters.back().get());
+                    overflowed.store(false); // after the store, a lookup that sees it reads the new filter
+                    return;
+                }
+                expected *= 2;
+            }
+        });
+    }
+
+public:
+    // constructor, initial_capacity as in CuckooSet; the filter starts sized for it
+    explicit CuckooFilteredSet(int initial_capacity) : Set(initial_capacity) {
+        start_filter(std::max(initial_capacity, 1));
+    }
+
+    CuckooFilteredSet(int initial_capacity, int lock_stripes) : Set(initial_capacity, lock_stripes) {
+        start_filter(std::max(initial_capacity, 1));
+    }
+
+    using Set::size;
+    using Set::approximate_size;
+    using Set::set_max_load_factor;
+    using Set::set_rehash_threads;
+    using Set::reserve;
+    using Set::stats;
+
+    // function to add a value to the set
+    bool add(const T& val) {
+        return add_value(val);
+    }
+
+    bool add(T&& val) {
+        return add_value(std::move(val));
+    }
+
+    // function to remove a value from the set
+    bool remove(const T& val) {
+        return Set::remove_and_visit(val, [this](const T& erased) {
+            if (!overflowed.load(std::memory_order_relaxed)) {
+                filter.load(std::memory_order_relaxed)->remove(erased);
+            }
+        });
+    }
+
+    // function to check if a value is in the set, answered by the filter alone when it is not
+    bool contains(const T& val) {
+        if (!overflowed.load() && !filter.load()->contains(val)) {
+            return false;
+        }
+        return Set::contains(val);
+    }
+
+    // function to get the bytes of the current filter
+    size_t filter_bytes() const {
+        return filter.load()->memory_bytes();
+    }
+
+    // function to give back memory as CuckooSet::shrink_to_fit does, replaced filters too. no
+    // other thread may use the set during the call
+    void shrink_to_fit() {
+        Set::shrink_to_fit();
+        filters.erase(filters.begin(), filters.end() - 1);
+    }
+
+    // function to populate the set with a list of entries
+    bool populate(const std::vector<T>& entries) {
+        for (const T& entry : entries) {
+            if (!add(entry)) {
+                return false; // return false if any duplicate entry is found
+            }
+        }
+        return true; // successfully added all entries
+    }
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// hash policies of the sets. a policy is a callable hash(val, seed) returning a 64-bit hash;
+// the sets take every bucket index from that one hash (see hash_part) and pass a new seed to
+// rehash in place
+
+// seed of a freshly constructed set
+constexpr uint64_t INITIAL_HASH_SEED = 0x2545F4914F6CDD1Dull;
+
+// function to mix a 64-bit value with a seed: multiply-xorshift rounds of the murmur3
+// finalizer, every input bit affects every output bit
+inline uint64_t mix64(uint64_t x, uint64_t seed) {
+    x ^= seed;
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// function to derive the seed a table is rehashed with after seed
+inline uint64_t next_seed(uint64_t seed) {
+    return mix64(seed + 0x9E3779B97F4A7C15ull, 0);
+}
+
+// function to fold the 128-bit product of two words into one (the wyhash mum)
+inline uint64_t fold_multiply(uint64_t a, uint64_t b) {
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+inline uint64_t read_word(const uint8_t* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+inline uint64_t read_half_word(const uint8_t* p) {
+    uint32_t half;
+    std::memcpy(&half, p, sizeof(half));
+    return half;
+}
+
+// function to hash a byte string, in the style of wyhash: 16 bytes per multiply in the main
+// loop, overlapping reads for the tail, no per-byte loop
+inline uint64_t hash_bytes(const void* data, std::size_t length, uint64_t seed) {
+    constexpr uint64_t SECRET0 = 0xA0761D6478BD642Full;
+    constexpr uint64_t SECRET1 = 0xE7037ED1A0B428DBull;
+    constexpr uint64_t SECRET2 = 0x8EBC6AF09C88C6E3ull;
+    constexpr uint64_t SECRET3 = 0x589965CC75374CC3ull;
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    seed ^= fold_multiply(seed ^ SECRET0, SECRET1);
+    uint64_t a;
+    uint64_t b;
+    if (length <= 16) {
+        if (length >= 4) {
+            std::size_t middle = (length >> 3) << 2;
+            a = (read_half_word(p) << 32) | read_half_word(p + middle);
+            b = (read_half_word(p + length - 4) << 32) | read_half_word(p + length - 4 - middle);
+        } else if (length > 0) {
+            a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[length >> 1]) << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        std::size_t left = length;
+        if (left > 48) {
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = fold_multiply(read_word(p) ^ SECRET1, read_word(p + 8) ^ seed);
+                seed1 = fold_multiply(read_word(p + 16) ^ SECRET2, read_word(p + 24) ^ seed1);
+                seed2 = fold_multiply(read_word(p + 32) ^ SECRET3, read_word(p + 40) ^ seed2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (left > 16) {
+            seed = fold_multiply(read_word(p) ^ SECRET1, read_word(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        a = read_word(p + left - 16);
+        b = read_word(p + left - 8);
+    }
+    return fold_multiply(SECRET1 ^ length, fold_multiply(a ^ SECRET1, b ^ seed));
+}
+
+// default policy: integers, enums and pointers go through mix64, byte strings through
+// hash_bytes, anything else mixes the output of std::hash, which for libstdc++ is often
+// the identity and must not pick buckets on its own. a policy that declares is_transparent
+// hashes other key types exactly like the values they compare equal to, which lets the sets
+// look up a std::string by std::string_view or const char* without building a string
+template <class T, class Enable = void>
+struct DefaultHash {
+    uint64_t operator()(const T& val, uint64_t seed) const {
+        return mix64(std::hash<T>{}(val), seed);
+    }
+};
+
+template <class T>
+struct DefaultHash<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+    uint64_t operator()(T val, uint64_t seed) const {
+        return mix64(static_cast<uint64_t>(val), seed);
+    }
+};
+
+template <class T>
+struct DefaultHash<T*> {
+    uint64_t operator()(T* val, uint64_t seed) const {
+        return mix64(reinterpret_cast<std::uintptr_t>(val), seed);
+    }
+};
+
+template <>
+struct DefaultHash<std::string> {
+    using is_transparent = void;
+
+    uint64_t operator()(std::string_view val, uint64_t seed) const {
+        return hash_bytes(val.data(), val.size(), seed);
+    }
+};
+
+template <>
+struct DefaultHash<std::string_view> {
+    using is_transparent = void;
+
+    uint64_t operator()(std::string_view val, uint64_t seed) const {
+        return hash_bytes(val.data(), val.size(), seed);
+    }
+};
+
+// function to get the part of a hash that picks the bucket in the given table: the low half
+// for table 0, the high half for table 1, and low + (table - 1) * high (double hashing) for
+// any further table, so one 64-bit hash serves up to four tables
+inline uint32_t hash_part(uint64_t hash, int table) {
+    uint32_t low = static_cast<uint32_t>(hash);
+    uint32_t high = static_cast<uint32_t>(hash >> 32);
+    return table == 0 ? low : table == 1 ? high : low + static_cast<uint32_t>(table - 1) * high;
+}
+
+// function to reduce a hash part to a power-of-two capacity by masking. doubling the
+// capacity sends bucket i to bucket i or i + capacity, which the incremental resize relies on
+inline int reduce_mask(uint32_t part, int capacity) {
+    return static_cast<int>(part & static_cast<uint32_t>(capacity - 1));
+}
@@ -0,0 +1,470 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "epoch.h"
+#include "hash_policy.h"
+#include "stats.h"
+
+// lock-free cuckoo hash set after Nguyen and Tsigas, "Lock-free Cuckoo Hashing" (ICDCS 2014).
+// two tables of one slot per bucket, each slot a single atomic word pointing to a node that
+// holds a value. every change is one compare-and-swap on a slot word: an add swings its
+// first-table slot from empty to a new node, a remove swings a slot back to empty, and a
+// relocation marks the slot it moves out of, copies the node into its other slot and then
+// clears the marked one. any thread that meets a marked slot finishes the relocation
+// before going on, so a thread stopped at any point never stalls the others. removed nodes
+// and replaced tables are freed through epoch-based reclamation (epoch.h).
+//
+// a lookup reads both slots of a value twice and retries if a relocation counter changed in
+// between, so it cannot miss a value that moved past it. adds only ever publish a value in
+// its first-table slot, so two adds of one value meet on the same word and it is never
+// stored twice.
+//
+// growing is not lock-free, as in the paper: when an add finds no cuckoo path the resizing
+// thread freezes every slot, so that no compare-and-swap on the table can succeed any more,
+// and copies the nodes into tables of twice the size. lookups keep reading the frozen tables
+// meanwhile; adds and removes that meet a frozen slot wait for the new ones
+template <class T, class Hash = DefaultHash<T>>
+class LockFreeCuckooSet {
+    static_assert(sizeof(void*) == 8, "a slot word keeps a counter in the 16 high bits of a 64-bit pointer");
+
+    // a value and its hash, allocated by the add that publishes it; the hash is kept so
+    // relocations and resizes never rehash
+    struct alignas(8) Node {
+        T val;
+        uint64_t hash;
+    };
+
+    // a slot word: the node pointer in bits 2 to 47, MARKED while the node is being relocated
+    // out of the slot, FROZEN once a resize copies the table, and in bits 48 to 63 the
+    // relocation counter, bumped whenever a relocation fills or empties the slot
+    using Word = uint64_t;
+    static constexpr Word MARKED = 1;
+    static constexpr Word FROZEN = 2;
+    static constexpr int COUNTER_SHIFT = 48;
+    static constexpr Word POINTER_MASK = ((Word(1) << COUNTER_SHIFT) - 1) & ~(MARKED | FROZEN);
+    // longest chain of relocations an add follows before the tables grow
+    static constexpr int MAX_RELOCATION_PATH = 32;
+    static constexpr int COUNT_SHARDS = 64;
+
+    static Node* node_of(Word word) {
+        return reinterpret_cast<Node*>(word & POINTER_MASK);
+    }
+
+    static uint16_t counter_of(Word word) {
+        return static_cast<uint16_t>(word >> COUNTER_SHIFT);
+    }
+
+    static Word make_word(Node* node, uint16_t counter) {
+        return reinterpret_cast<Word>(node) | static_cast<Word>(counter) << COUNTER_SHIFT;
+    }
+
+    // both tables of one size, a resize replaces them as a whole
+    struct Table {
+        int capacity; // slots in each table, always a power of two
+        // table t is [t * capacity, (t + 1) * capacity)
+        std::unique_ptr<std::atomic<Word>[]> slots;
+
+        explicit Table(int capacity) : capacity(capacity), slots(new std::atomic<Word>[2 * static_cast<size_t>(capacity)]) {
+            for (size_t i = 0; i < 2 * static_cast<size_t>(capacity); i++) {
+                slots[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<Word>& slot(int table, int index) {
+            return slots[static_cast<size_t>(table) * capacity + index];
+        }
+
+        int index_of(uint64_t hash, int table) const {
+            return reduce_mask(hash_part(hash, table), capacity);
+        }
+    };
+
+    // outcome of find: the value is in its slot of the first or second table, in neither, or
+    // a frozen slot was met and the caller has to wait for the resize
+    enum Found { NONE, FIRST, SECOND, BUSY };
+
+    // value count in cache-line shards picked per thread
+    struct alignas(CACHE_LINE_SIZE) CountShard {
+        std::atomic<int64_t> values{0};
+    };
+
+    std::atomic<Table*> table;
+    std::unique_ptr<CountShard[]> counts;
+    std::mutex resize_lock; // one resize at a time
+    EpochDomain& domain = EpochDomain::global();
+    StatsRecorder<true> counters; // hot-path counters, empty unless CUCKOO_STATS is defined
+    Hash hasher;
+
+    // function to change the value count of the calling thread's shard
+    void count_change(int64_t delta) {
+        static std::atomic<unsigned> next_shard{0};
+        static thread_local unsigned shard = next_shard.fetch_add(1, std::memory_order_relaxed) % COUNT_SHARDS;
+        counts[shard].values.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    // function to read both slots of a value once, first table first. returns the table
+    // holding it, -1 if neither does, or with help BUSY for a frozen slot and -2 after
+    // helping a relocation, which asks for a new read
+    int read_slots(Table& current, const int* index, const T& val, uint64_t hash, Word* words, bool help) {
+        for (int table = 0; table < 2; table++) {
+            Word word = current.slot(table, index[table]).load(std::memory_order_acquire);
+            if (help) {
+                if (word & FROZEN) {
+                    return BUSY;
+                }
+                if (word & MARKED) {
+                    help_relocate(current, table, index[table], false);
+                    return -2;
+                }
+            }
+            words[table] = word;
+            Node* node = node_of(word);
+            if (node != nullptr && node->hash == hash && node->val == val) {
+                return table;
+            }
+        }
+        return -1;
+    }
+
+    // function to find a value in its two slots, with the words last read from them in
+    // first and second. both slots are read twice, and a miss only counts when neither
+    // relocation counter changed in between; otherwise the value might have moved from the
+    // slot read second to the one read first, and the search starts over. writers pass help
+    // to finish the relocations they meet and to stop at frozen slots
+    Found find(Table& current, const T& val, uint64_t hash, Word& first, Word& second, bool help) {
+        int index[2] = {current.index_of(hash, 0), current.index_of(hash, 1)};
+        for (;;) {
+            Word before[2] = {0, 0};
+            Word after[2] = {0, 0};
+            int table = read_slots(current, index, val, hash, before, help);
+            if (table == -1) {
+                table = read_slots(current, index, val, hash, after, help);
+                if (table == -1 && (counter_of(before[0]) != counter_of(after[0]) || counter_of(before[1]) != counter_of(after[1]))) {
+                    continue; // a relocation went past, the value may have been missed
+                }
+            } else {
+                after[0] = before[0];
+                after[1] = before[1];
+            }
+            if (table == -2) {
+                continue;
+            }
+            if (table == BUSY) {
+                return BUSY;
+            }
+            first = after[0];
+            second = after[1];
+            return table == -1 ? NONE : table == 0 ? FIRST : SECOND;
+        }
+    }
+
+    // function to move the node of a slot to its slot in the other table, which must be
+    // empty. the initiator marks the slot first; helpers only finish a relocation whose mark
+    // they found. the node is copied before the marked slot is cleared, so it is always in
+    // at least one of its slots. false if the slot was empty or its other slot taken, the
+    // mark is undone then
+    bool help_relocate(Table& current, int which, int index, bool initiator) {
+        std::atomic<Word>& source = current.slot(which, index);
+        for (;;) {
+            Word src = source.load(std::memory_order_acquire);
+            while (initiator && !(src & MARKED)) {
+                if (node_of(src) == nullptr || (src & FROZEN)) {
+                    return false;
+                }
+                if (source.compare_exchange_strong(src, src | MARKED, std::memory_order_acq_rel)) {
+                    src |= MARKED;
+                }
+            }
+            if (!(src & MARKED) || (src & FROZEN)) {
+                return false; // finished or undone by another thread
+            }
+            Node* node = node_of(src);
+            std::atomic<Word>& target = current.slot(1 - which, current.index_of(node->hash, 1 - which));
+            Word dst = target.load(std::memory_order_acquire);
+            if (dst & FROZEN) {
+                return false;
+            }
+            uint16_t moved = static_cast<uint16_t>(std::max(counter_of(src), counter_of(dst)) + 1);
+            Word emptied = make_word(nullptr, static_cast<uint16_t>(counter_of(src) + 1));
+            if (node_of(dst) == nullptr) {
+                if (source.load(std::memory_order_acquire) != src) {
+                    continue;
+                }
+                if (target.compare_exchange_strong(dst, make_word(node, moved), std::memory_order_acq_rel)) {
+                    source.compare_exchange_strong(src, emptied, std::memory_order_acq_rel);
+                    return true;
+                }
+                continue; // the target changed, look again
+            }
+            if (node_of(dst) == node) { // copied by another helper
+                source.compare_exchange_strong(src, emptied, std::memory_order_acq_rel);
+                return true;
+            }
+            source.compare_exchange_strong(src, src & ~MARKED, std::memory_order_acq_rel); // target taken
+            return false;
+        }
+    }
+
+    // function to empty the first-table slot start by walking the chain of displacements
+    // from it (each node to its slot in the other table) up to the first empty slot and
+    // relocating backwards from there. true once the slot may be free, or when a frozen slot
+    // was met; false if the chain is longer than MAX_RELOCATION_PATH, the tables must grow
+    bool relocate(Table& current, int start) {
+        int route[MAX_RELOCATION_PATH];
+        for (int attempt = 0; attempt < MAX_RELOCATION_PATH; attempt++) {
+            int table = 0;
+            int index = start;
+            int depth = 0;
+            bool helped = false;
+            while (depth < MAX_RELOCATION_PATH) {
+                Word word = current.slot(table, index).load(std::memory_order_acquire);
+                if (word & FROZEN) {
+                    return true; // the add waits for the resize
+                }
+                if (word & MARKED) {
+                    help_relocate(current, table, index, false);
+                    helped = true;
+                    break;
+                }
+                Node* node = node_of(word);
+                if (node == nullptr) {
+                    break;
+                }
+                route[depth++] = index;
+                index = current.index_of(node->hash, 1 - table);
+                table = 1 - table;
+            }
+            if (helped) {
+                continue;
+            }
+            if (depth == MAX_RELOCATION_PATH) {
+                return false;
+            }
+            bool moved = true;
+            for (int hop = depth - 1; hop >= 0 && moved; hop--) {
+                moved = help_relocate(current, hop & 1, route[hop], true); // hop i lies in table i % 2
+            }
+            if (moved) {
+                if (depth > 0) {
+                    counters.relocation(depth);
+                }
+                return true;
+            }
+        }
+        return true; // the chain kept changing under other writers, the add looks again
+    }
+
+    // function to wait until a resize replaces current
+    void wait_for_resize(Table* current) {
+        while (table.load(std::memory_order_acquire) == current) {
+            std::this_thread::yield();
+        }
+    }
+
+    // function to place a node in tables no other thread can reach, kicking nodes to their
+    // other slot until one lands in an empty slot. false if the chain grew too long, the
+    // tables are left inconsistent then and must be dropped
+    static bool place_private(Table& target, Node* node) {
+        for (int table = 0; table < 2; table++) {
+            std::atomic<Word>& slot = target.slot(table, target.index_of(node->hash, table));
+            if (node_of(slot.load(std::memory_order_relaxed)) == nullptr) {
+                slot.store(make_word(node, 0), std::memory_order_relaxed);
+                return true;
+            }
+        }
+        int table = 0;
+        for (int hop = 0; hop < 4 * MAX_RELOCATION_PATH; hop++) {
+            std::atomic<Word>& slot = target.slot(table, target.index_of(node->hash, table));
+            Word kicked = slot.load(std::memory_order_relaxed);
+            slot.store(make_word(node, 0), std::memory_order_relaxed);
+            node = node_of(kicked);
+            if (node == nullptr) {
+                return true;
+            }
+            table = 1 - table;
+        }
+        return false;
+    }
+
+    // function to replace the tables by tables of twice the size, unless another thread
+    // already replaced expected. every slot is frozen first; after that no compare-and-swap
+    // on the old tables can succeed, so they are a stable copy to read the nodes from, and a
+    // node caught mid-relocation in two slots is copied once
+    void resize(Table* expected) {
+        std::lock_guard<std::mutex> guard(resize_lock);
+        if (table.load(std::memory_order_acquire) != expected) {
+            return;
+        }
+        StatsTimer timer;
+        std::vector<Node*> nodes;
+        for (size_t i = 0; i < 2 * static_cast<size_t>(expected->capacity); i++) {
+            std::atomic<Word>& slot = expected->slots[i];
+            Word word = slot.load(std::memory_order_acquire);
+            while (!(word & FROZEN) && !slot.compare_exchange_weak(word, word | FROZEN, std::memory_order_acq_rel)) {
+            }
+            if (node_of(word) != nullptr) {
+                nodes.push_back(node_of(word));
+            }
+        }
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+        for (int capacity = expected->capacity * 2;; capacity *= 2) {
+            std::unique_ptr<Table> grown(new Table(capacity));
+            bool placed = true;
+            for (size_t i = 0; i < nodes.size() && placed; i++) {
+                placed = place_private(*grown, nodes[i]);
+            }
+            if (placed) {
+                table.store(grown.release(), std::memory_order_release);
+                break;
+            }
+        }
+        domain.retire(expected); // lock-free readers may still be reading it
+        counters.resize(timer.elapsed_ns());
+    }
+
+    // function to add a value, moved into its node when it is an rvalue
+    template <class V>
+    bool add_value(V&& val) {
+        uint64_t hash = hasher(val, INITIAL_HASH_SEED);
+        Node* node = nullptr; // allocated once the value is known to be absent
+        EpochGuard guard(domain);
+        for (;;) {
+            const T& key = node != nullptr ? node->val : val;
+            Table* current = table.load(std::memory_order_acquire);
+            Word first;
+            Word second;
+            Found found = find(*current, key, hash, first, second, true);
+            if (found == BUSY) {
+                wait_for_resize(current);
+                continue;
+            }
+            if (found != NONE) {
+                delete node; // never published
+                return false;
+            }
+            int index = current->index_of(hash, 0);
+            if (node_of(first) == nullptr) {
+                if (node == nullptr) {
+                    node = new Node{T(std::forward<V>(val)), hash};
+                }
+                if (current->slot(0, index).compare_exchange_strong(first, make_word(node, counter_of(first)),
+                                                                    std::memory_order_acq_rel)) {
+                    count_change(1);
+                    return true;
+                }
+                continue;
+            }
+            if (!relocate(*current, index)) {
+                counters.failed_search();
+                resize(current);
+            }
+        }
+    }
+
+public:
+    // constructor, initial_capacity is the number of values the set should hold before the
+    // first resize; a table of single slots fills to about half
+    explicit LockFreeCuckooSet(int initial_capacity) : counts(new CountShard[COUNT_SHARDS]) {
+        int capacity = 1;
+        while (capacity < initial_capacity) {
+            capacity <<= 1;
+        }
+        table.store(new Table(capacity), std::memory_order_relaxed);
+    }
+
+    LockFreeCuckooSet(const LockFreeCuckooSet&) = delete;
+    LockFreeCuckooSet& operator=(const LockFreeCuckooSet&) = delete;
+
+    // destructor, no other thread may be using the set
+    ~LockFreeCuckooSet() {
+        Table* current = table.load(std::memory_order_acquire);
+        for (size_t i = 0; i < 2 * static_cast<size_t>(current->capacity); i++) {
+            delete node_of(current->slots[i].load(std::memory_order_relaxed));
+        }
+        delete current;
+    }
+
+    // function to add a value to the set
+    bool add(const T& val) {
+        return add_value(val);
+    }
+
+    // function to add a value to the set, moving it into its node
+    bool add(T&& val) {
+        return add_value(std::move(val));
+    }
+
+    // function to remove a value from the set, its node is freed once no lookup can see it
+    bool remove(const T& val) {
+        uint64_t hash = hasher(val, INITIAL_HASH_SEED);
+        EpochGuard guard(domain);
+        for (;;) {
+            Table* current = table.load(std::memory_order_acquire);
+            Word words[2];
+            Found found = find(*current, val, hash, words[0], words[1], true);
+            if (found == BUSY) {
+                wait_for_resize(current);
+                continue;
+            }
+            if (found == NONE) {
+                return false;
+            }
+            int which = found == FIRST ? 0 : 1;
+            Word word = words[which];
+            if (current->slot(which, current->index_of(hash, which)).compare_exchange_strong(
+                        word, make_word(nullptr, counter_of(word)), std::memory_order_acq_rel)) {
+                domain.retire(node_of(words[which]));
+                count_change(-1);
+                return true;
+            }
+        }
+    }
+
+    // function to check if a value is in the set, without ever waiting: a frozen table is
+    // still read while it is being copied
+    bool contains(const T& val) {
+        uint64_t hash = hasher(val, INITIAL_HASH_SEED);
+        EpochGuard guard(domain);
+        Word first;
+        Word second;
+        counters.lookup();
+        return find(*table.load(std::memory_order_acquire), val, hash, first, second, false) != NONE;
+    }
+
+    // function to get the number of elements in the set, exact once no add or remove is running
+    int size() {
+        int64_t values = 0;
+        for (int shard = 0; shard < COUNT_SHARDS; shard++) {
+            values += counts[shard].values.load(std::memory_order_relaxed);
+        }
+        return static_cast<int>(std::max<int64_t>(values, 0));
+    }
+
+    // function to read the hot-path counters, all zero unless CUCKOO_STATS is defined. the
+    // load factor is over the slots of the current tables
+    CuckooStats stats() {
+        CuckooStats snapshot = counters.snapshot();
+        snapshot.load_factor = static_cast<double>(size()) / (2.0 * table.load(std::memory_order_acquire)->capacity);
+        return snapshot;
+    }
+
+    // function to populate the set with a list of entries
+    bool populate(const std::vector<T>& entries) {
+        for (const T& entry : entries) {
+            if (!add(entry)) {
+                return false; // return false if any duplicate entry is found
+            }
+        }
+        return true; // successfully added all entries
+    }
+};
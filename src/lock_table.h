@@ -0,0 +1,292 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "aligned_allocator.h"
+#include "stats.h"
+
+// function to tell the core we are busy waiting
+inline void cpu_relax() {
+#if defined(__SSE2__)
+    _mm_pause();
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// non-recursive test-and-test-and-set spinlock. waiters spin on a plain load so the line
+// stays shared until the holder releases it, back off exponentially between attempts,
+// and yield the core once the backoff is saturated in case the holder was preempted
+class SpinLock {
+    static constexpr unsigned MAX_BACKOFF = 1024;
+
+    std::atomic<bool> locked{false};
+
+public:
+    void lock() {
+        unsigned backoff = 1;
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+                if (backoff < MAX_BACKOFF) {
+                    for (unsigned i = 0; i < backoff; i++) {
+                        cpu_relax();
+                    }
+                    backoff <<= 1;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    bool try_lock() {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+};
+
+// short list of the stripes one operation holds, kept on the stack
+template <int N>
+struct StripeList {
+    std::size_t stripes[N];
+    int count = 0;
+
+    void clear() {
+        count = 0;
+    }
+
+    void push(std::size_t stripe) {
+        stripes[count++] = stripe;
+    }
+
+    std::size_t* begin() { return stripes; }
+    std::size_t* end() { return stripes + count; }
+    const std::size_t* begin() const { return stripes; }
+    const std::size_t* end() const { return stripes + count; }
+};
+
+// fixed table of lock stripes shared by every bucket of a hash set. bucket i of any table
+// is guarded by stripe i & (size - 1), so the stripe count never changes when the tables
+// grow. each stripe sits on its own cache line next to a seqlock version that lets readers
+// validate what they read without taking the lock
+class LockTable {
+public:
+    // lock policy of CuckooSet: stripes really lock, shared state is atomic
+    static constexpr bool CONCURRENT = true;
+    template <class U>
+    using Atomic = std::atomic<U>;
+    using ReaderLock = SpinLock;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Stripe {
+        SpinLock lock;
+        std::atomic<uint64_t> version{0}; // odd while a writer holds the stripe
+    };
+
+    std::size_t mask;
+    std::unique_ptr<Stripe[]> stripes;
+    StatsRecorder<true> lock_stats; // acquisitions, contention and wait time
+
+    // function to take the spinlock of a stripe, timing the wait when it is contended
+    void acquire(std::size_t stripe) {
+        if constexpr (!CUCKOO_STATS_ENABLED) {
+            stripes[stripe].lock.lock();
+            return;
+        }
+        if (stripes[stripe].lock.try_lock()) {
+            lock_stats.lock_acquired(false, 0);
+            return;
+        }
+        StatsTimer timer;
+        stripes[stripe].lock.lock();
+        lock_stats.lock_acquired(true, timer.elapsed_ns());
+    }
+
+public:
+    // constructor rounding the stripe count up to a power of two
+    explicit LockTable(std::size_t min_stripes) {
+        std::size_t count = 1;
+        while (count < min_stripes) {
+            count <<= 1;
+        }
+        mask = count - 1;
+        stripes.reset(new Stripe[count]);
+    }
+
+    std::size_t size() const {
+        return mask + 1;
+    }
+
+    // function to map a bucket index to the stripe that guards it
+    std::size_t stripe_of(std::size_t index) const {
+        return index & mask;
+    }
+
+    // function to take a stripe for writing, its readers retry until it is released
+    void lock(std::size_t stripe) {
+        acquire(stripe);
+        stripes[stripe].version.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    // function to release a stripe taken by lock
+    void unlock(std::size_t stripe) {
+        stripes[stripe].version.fetch_add(1, std::memory_order_release);
+        stripes[stripe].lock.unlock();
+    }
+
+    // function to take several stripes for writing. the list is sorted and deduplicated in
+    // place, so every caller takes its stripes in ascending order and no two can deadlock
+    template <int N>
+    void lock(StripeList<N>& held) {
+        std::sort(held.begin(), held.end());
+        held.count = static_cast<int>(std::unique(held.begin(), held.end()) - held.begin());
+        for (std::size_t stripe : held) {
+            lock(stripe);
+        }
+    }
+
+    // function to release the stripes taken by lock(held)
+    template <int N>
+    void unlock(const StripeList<N>& held) {
+        for (std::size_t stripe : held) {
+            unlock(stripe);
+        }
+    }
+
+    // function to take every stripe in ascending order. versions are left alone: this stops
+    // all writers but not optimistic readers, so the holder may only change buckets that
+    // readers cannot reach yet
+    void lock_all() {
+        for (std::size_t stripe = 0; stripe <= mask; stripe++) {
+            acquire(stripe);
+        }
+    }
+
+    // function to release every stripe taken by lock_all
+    void unlock_all() {
+        for (std::size_t stripe = 0; stripe <= mask; stripe++) {
+            stripes[stripe].lock.unlock();
+        }
+    }
+
+    // lock of a stripe without the version, for callers that only read under it
+    SpinLock& reader_lock(std::size_t stripe) {
+        return stripes[stripe].lock;
+    }
+
+    // function to take several stripes for reading only: like lock(held), in ascending order,
+    // but the versions are left alone, so writers wait and optimistic readers do not
+    template <int N>
+    void lock_readers(StripeList<N>& held) {
+        std::sort(held.begin(), held.end());
+        held.count = static_cast<int>(std::unique(held.begin(), held.end()) - held.begin());
+        for (std::size_t stripe : held) {
+            acquire(stripe);
+        }
+    }
+
+    // function to release the stripes taken by lock_readers(held)
+    template <int N>
+    void unlock_readers(const StripeList<N>& held) {
+        for (std::size_t stripe : held) {
+            stripes[stripe].lock.unlock();
+        }
+    }
+
+    // function to start an optimistic read of a stripe, odd means a writer holds it
+    uint64_t read_begin(std::size_t stripe) const {
+        return stripes[stripe].version.load(std::memory_order_acquire);
+    }
+
+    // function to read the lock counters, all zero unless CUCKOO_STATS is defined
+    CuckooStats stats() const {
+        return lock_stats.snapshot();
+    }
+
+    // function to check that no writer took the stripe since read_begin returned version
+    bool read_validate(std::size_t stripe, uint64_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return stripes[stripe].version.load(std::memory_order_relaxed) == version;
+    }
+};
+
+// lock policy of CuckooSet for sets shared between threads
+using StripedLock = LockTable;
+
+// value with the interface of std::atomic that is an ordinary variable, for NoLock. the
+// sequential set runs inside GCC transactions, which do not allow atomic instructions
+template <class U>
+class PlainValue {
+    U value;
+
+public:
+    PlainValue(U value = U()) : value(value) {}
+
+    U load(std::memory_order = std::memory_order_seq_cst) const {
+        return value;
+    }
+
+    void store(U next, std::memory_order = std::memory_order_seq_cst) {
+        value = next;
+    }
+
+    U fetch_add(U increment, std::memory_order = std::memory_order_seq_cst) {
+        U previous = value;
+        value += increment;
+        return previous;
+    }
+};
+
+// lock policy of CuckooSet for a set used by one thread at a time: a single "stripe" whose
+// locking and validation compile to nothing
+class NoLock {
+public:
+    static constexpr bool CONCURRENT = false;
+    template <class U>
+    using Atomic = PlainValue<U>;
+
+    // stand-in for the lock of a stripe
+    struct ReaderLock {
+        void lock() {}
+        void unlock() {}
+    };
+
+private:
+    ReaderLock nothing;
+
+public:
+    explicit NoLock(std::size_t) {}
+
+    std::size_t size() const { return 1; }
+    std::size_t stripe_of(std::size_t) const { return 0; }
+    void lock(std::size_t) {}
+    void unlock(std::size_t) {}
+    template <int N>
+    void lock(StripeList<N>&) {}
+    template <int N>
+    void unlock(const StripeList<N>&) {}
+    void lock_all() {}
+    void unlock_all() {}
+    ReaderLock& reader_lock(std::size_t) { return nothing; }
+    template <int N>
+    void lock_readers(StripeList<N>&) {}
+    template <int N>
+    void unlock_readers(const StripeList<N>&) {}
+    uint64_t read_begin(std::size_t) const { return 0; }
+    bool read_validate(std::size_t, uint64_t) const { return true; }
+    CuckooStats stats() const { return CuckooStats(); }
+};
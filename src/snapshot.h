@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash_policy.h"
+
+// on-disk image of a cuckoo set, written by save and mapped back by open_mapped: a header,
+// padding up to SNAPSHOT_DATA_OFFSET, the buckets of every table exactly as they are laid
+// out in memory, then the stashed values. the buckets start on a page boundary so the
+// mapping can serve them in place
+
+constexpr uint64_t SNAPSHOT_MAGIC = 0x31504E5343554B43ull; // "CKUCSNP1" read as little endian
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr std::size_t SNAPSHOT_DATA_OFFSET = 4096;
+
+struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    // shape the image was written for, it only maps back into the same instantiation
+    uint32_t num_tables;
+    uint32_t bucket_ways;
+    uint32_t value_size;
+    uint32_t bucket_size;
+    uint64_t capacity; // buckets in each table
+    uint64_t seed;
+    uint32_t reseeds;
+    uint32_t stashed;    // values following the buckets
+    uint64_t values;     // values in all, stashed ones included
+    uint64_t probe_hash; // hash of a default value, catches most changes of hash policy
+    uint64_t checksum;   // of the buckets, then of the stashed values
+};
+
+// function to checksum the data of an image: the stashed values are hashed with the hash of
+// the buckets as seed
+inline uint64_t snapshot_checksum(const void* buckets, std::size_t bucket_bytes, const void* stashed,
+                                  std::size_t stashed_bytes) {
+    return hash_bytes(stashed, stashed_bytes, hash_bytes(buckets, bucket_bytes, SNAPSHOT_MAGIC));
+}
+
+// function to write an image to path through a temporary file renamed over it, so a reader
+// never maps half an image. false if any step failed, path is untouched then
+inline bool write_snapshot(const std::string& path, const SnapshotHeader& header, const void* buckets,
+                           std::size_t bucket_bytes, const void* stashed, std::size_t stashed_bytes) {
+    std::string temporary = path + ".tmp";
+    std::FILE* out = std::fopen(temporary.c_str(), "wb");
+    if (out == nullptr) {
+        return false;
+    }
+    static const char padding[SNAPSHOT_DATA_OFFSET] = {};
+    bool written = std::fwrite(&header, sizeof(header), 1, out) == 1
+                && std::fwrite(padding, SNAPSHOT_DATA_OFFSET - sizeof(header), 1, out) == 1
+                && (bucket_bytes == 0 || std::fwrite(buckets, bucket_bytes, 1, out) == 1)
+                && (stashed_bytes == 0 || std::fwrite(stashed, stashed_bytes, 1, out) == 1)
+                && std::fflush(out) == 0 && fsync(fileno(out)) == 0;
+    written = std::fclose(out) == 0 && written;
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// private read-write mapping of a whole file: pages are read from the file on first touch,
+// and a write copies its page into anonymous memory, so the file never changes
+class MappedFile {
+    void* base = MAP_FAILED;
+    std::size_t length = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (base != MAP_FAILED) {
+            munmap(base, length);
+        }
+    }
+
+    // function to map path, false if it cannot be opened or mapped
+    bool map(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            length = static_cast<std::size_t>(info.st_size);
+            base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        }
+        close(fd); // the mapping keeps the file alive
+        return base != MAP_FAILED;
+    }
+
+    char* data() const {
+        return static_cast<char*>(base);
+    }
+
+    std::size_t size() const {
+        return base == MAP_FAILED ? 0 : length;
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include "aligned_allocator.h"
+
+// small overflow area of a cuckoo set: the rare values that find no cuckoo path wait here,
+// searched linearly, instead of growing the tables for one unlucky value. with a concurrent
+// lock policy the stash has its own lock, taken after the stripes of the value stashed or
+// unstashed, and a seqlock version that lock-free readers validate
+template <class T, int SLOTS, class LockPolicy>
+class alignas(CACHE_LINE_SIZE) Stash {
+    template <class U>
+    using Shared = typename LockPolicy::template Atomic<U>;
+
+    typename LockPolicy::ReaderLock guard;
+    Shared<uint64_t> version{0}; // odd while a writer holds the stash
+    Shared<int> used{0};         // occupied slots
+    bool occupied[SLOTS] = {};
+    T keys[SLOTS];
+
+public:
+    // function to check, without the lock, whether nothing is stashed
+    bool empty() const {
+        return used.load(std::memory_order_acquire) == 0;
+    }
+
+    // function to get the number of stashed values
+    int size() const {
+        return used.load(std::memory_order_acquire);
+    }
+
+    // function to take the stash for writing, lock-free readers retry until it is released
+    void lock() {
+        guard.lock();
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if constexpr (LockPolicy::CONCURRENT) {
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+    }
+
+    // function to release the stash taken by lock
+    void unlock() {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        guard.unlock();
+    }
+
+    // lock of the stash without the version, for holders that only read: writers wait,
+    // lock-free readers do not
+    typename LockPolicy::ReaderLock& reader_lock() {
+        return guard;
+    }
+
+    // function to find the slot holding a value, -1 if it is not stashed. the caller holds
+    // the stash or is the only thread using it
+    template <class K>
+    int find(const K& val) const {
+        for (int slot = 0; slot < SLOTS; slot++) {
+            if (occupied[slot] && keys[slot] == val) {
+                return slot;
+            }
+        }
+        return -1;
+    }
+
+    // function to check for a value, keeping writers out but not disturbing readers
+    template <class K>
+    bool contains(const K& val) {
+        if (empty()) {
+            return false;
+        }
+        guard.lock();
+        bool found = find(val) >= 0;
+        guard.unlock();
+        return found;
+    }
+
+    // function to call f(value) on the stashed value equal to key with the stash held, which
+    // makes lock-free readers retry, so f may change it in place. false if it is not stashed
+    template <class K, class F>
+    bool visit(const K& key, F&& f) {
+        if (empty()) {
+            return false;
+        }
+        lock();
+        int slot = find(key);
+        if (slot >= 0) {
+            f(keys[slot]);
+        }
+        unlock();
+        return slot >= 0;
+    }
+
+    // function to check for a value without the lock, calling read(value) when it is found.
+    // false if a writer held or took the stash, in which case found and whatever read saw
+    // are meaningless and the probe has to be retried
+    template <class K, class F>
+    bool try_probe(const K& val, bool& found, F&& read) const {
+        uint64_t before = version.load(std::memory_order_acquire);
+        if (before & 1) {
+            return false;
+        }
+        int slot = find(val);
+        found = slot >= 0;
+        if (found) {
+            read(keys[slot]);
+        }
+        if constexpr (LockPolicy::CONCURRENT) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return version.load(std::memory_order_relaxed) == before;
+    }
+
+    // function to get the value of an occupied slot, the caller holds the stash
+    T& at(int slot) {
+        return keys[slot];
+    }
+
+    // function to copy the value of a slot, false if the slot is free
+    bool copy_slot(int slot, T& val) {
+        guard.lock();
+        bool taken = occupied[slot];
+        if (taken) {
+            val = keys[slot];
+        }
+        guard.unlock();
+        return taken;
+    }
+
+    // function to stash a value, moved in when it is an rvalue, false if every slot is taken
+    // (the value is left alone then). the caller holds the stash
+    template <class V>
+    bool insert(V&& val) {
+        for (int slot = 0; slot < SLOTS; slot++) {
+            if (!occupied[slot]) {
+                keys[slot] = std::forward<V>(val);
+                occupied[slot] = true;
+                used.store(used.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // function to free a slot, dropping whatever its value owns. the caller holds the stash
+    void erase(int slot) {
+        occupied[slot] = false;
+        keys[slot] = T();
+        used.store(used.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+
+    // function to free every slot. the caller holds the stash
+    void clear() {
+        for (int slot = 0; slot < SLOTS; slot++) {
+            if (occupied[slot]) {
+                erase(slot);
+            }
+        }
+    }
+};
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#include "aligned_allocator.h"
+#include "cuckoo_path.h"
+
+// hot-path counters of the hash sets, compiled in with -DCUCKOO_STATS (make STATS=1).
+// without the define every recording call is an empty inline function and no counter
+// storage is allocated, so the sets cost exactly what they did before
+#ifdef CUCKOO_STATS
+constexpr bool CUCKOO_STATS_ENABLED = true;
+#else
+constexpr bool CUCKOO_STATS_ENABLED = false;
+#endif
+
+// snapshot of the counters of one set, all zero when the counters are compiled out
+struct CuckooStats {
+    uint64_t lookups = 0;                // contains calls
+    uint64_t probes = 0;                 // buckets read by those lookups, retries included
+    uint64_t relocations = 0;            // inserts that displaced values along a cuckoo path
+    // path_histogram[n] counts the relocations that moved n values
+    uint64_t path_histogram[MAX_CUCKOO_PATH_LENGTH] = {};
+    uint64_t failed_searches = 0;        // path searches that found no free way
+    uint64_t stashed = 0;                // values put in the overflow stash
+    uint64_t resizes = 0;                // rebuilds that grew the table
+    uint64_t reseeds = 0;                // rebuilds that kept the capacity and changed the hash seed
+    uint64_t resize_ns = 0;              // time spent in both kinds of rebuild
+    uint64_t lock_acquisitions = 0;
+    uint64_t contended_acquisitions = 0; // acquisitions that found the stripe taken
+    uint64_t lock_wait_ns = 0;           // time spent waiting for those stripes
+    double load_factor = 0;              // values over ways, filled in by the set
+
+    double probes_per_lookup() const {
+        return lookups == 0 ? 0 : static_cast<double>(probes) / lookups;
+    }
+
+    CuckooStats& operator+=(const CuckooStats& other) {
+        lookups += other.lookups;
+        probes += other.probes;
+        relocations += other.relocations;
+        for (int i = 0; i < MAX_CUCKOO_PATH_LENGTH; i++) {
+            path_histogram[i] += other.path_histogram[i];
+        }
+        failed_searches += other.failed_searches;
+        stashed += other.stashed;
+        resizes += other.resizes;
+        reseeds += other.reseeds;
+        resize_ns += other.resize_ns;
+        lock_acquisitions += other.lock_acquisitions;
+        contended_acquisitions += other.contended_acquisitions;
+        lock_wait_ns += other.lock_wait_ns;
+        return *this;
+    }
+
+    // function to dump the snapshot as one JSON object
+    std::string to_json() const {
+        std::ostringstream out;
+        out << "{\"lookups\":" << lookups << ",\"probes\":" << probes
+            << ",\"probes_per_lookup\":" << probes_per_lookup()
+            << ",\"relocations\":" << relocations << ",\"path_histogram\":[";
+        for (int i = 0; i < MAX_CUCKOO_PATH_LENGTH; i++) {
+            out << (i == 0 ? "" : ",") << path_histogram[i];
+        }
+        out << "],\"failed_searches\":" << failed_searches << ",\"stashed\":" << stashed
+            << ",\"resizes\":" << resizes
+            << ",\"reseeds\":" << reseeds
+            << ",\"resize_ns\":" << resize_ns << ",\"lock_acquisitions\":" << lock_acquisitions
+            << ",\"contended_acquisitions\":" << contended_acquisitions
+            << ",\"lock_wait_ns\":" << lock_wait_ns << ",\"load_factor\":" << load_factor << "}";
+        return out.str();
+    }
+
+    // function to get the column names matching to_csv
+    static std::string csv_header() {
+        std::ostringstream out;
+        out << "lookups,probes,probes_per_lookup,relocations";
+        for (int i = 0; i < MAX_CUCKOO_PATH_LENGTH; i++) {
+            out << ",path_" << i;
+        }
+        out << ",failed_searches,stashed,resizes,reseeds,resize_ns,lock_acquisitions,contended_acquisitions,lock_wait_ns,load_factor";
+        return out.str();
+    }
+
+    // function to dump the snapshot as one CSV row
+    std::string to_csv() const {
+        std::ostringstream out;
+        out << lookups << "," << probes << "," << probes_per_lookup() << "," << relocations;
+        for (int i = 0; i < MAX_CUCKOO_PATH_LENGTH; i++) {
+            out << "," << path_histogram[i];
+        }
+        out << "," << failed_searches << "," << stashed << "," << resizes << "," << reseeds << "," << resize_ns << "," << lock_acquisitions
+            << "," << contended_acquisitions << "," << lock_wait_ns << "," << load_factor;
+        return out.str();
+    }
+};
+
+// function to add to a counter owned by a single thread
+inline void bump(uint64_t& counter, uint64_t n) {
+    counter += n;
+}
+
+// function to add to a counter that threads may share
+inline void bump(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline uint64_t read_counter(const uint64_t& counter) {
+    return counter;
+}
+
+inline uint64_t read_counter(const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+// stopwatch for the timed counters, it does not read the clock when they are compiled out
+class StatsTimer {
+    std::chrono::steady_clock::time_point start;
+
+public:
+    StatsTimer() {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    uint64_t elapsed_ns() const {
+        if constexpr (!CUCKOO_STATS_ENABLED) {
+            return 0;
+        } else {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+};
+
+// counters of a set. the concurrent sets spread them over padded slots picked per thread,
+// so recording never adds a shared cache line to an operation. the sequential set keeps a
+// single slot of plain counters, which stay safe to bump inside a GCC transaction
+template <bool Concurrent>
+class StatsRecorder {
+    using Counter = typename std::conditional<Concurrent, std::atomic<uint64_t>, uint64_t>::type;
+
+    static constexpr unsigned SLOTS = Concurrent ? 64 : 1;
+
+    struct alignas(CACHE_LINE_SIZE) StatCounters {
+        Counter lookups{0};
+        Counter probes{0};
+        Counter relocations{0};
+        Counter path_histogram[MAX_CUCKOO_PATH_LENGTH] = {};
+        Counter failed_searches{0};
+        Counter stashed{0};
+        Counter resizes{0};
+        Counter reseeds{0};
+        Counter resize_ns{0};
+        Counter lock_acquisitions{0};
+        Counter contended_acquisitions{0};
+        Counter lock_wait_ns{0};
+    };
+
+    std::unique_ptr<StatCounters[]> slots;
+
+    // function to get the counter slot of the calling thread
+    StatCounters& slot() {
+        if constexpr (!Concurrent) {
+            return slots[0];
+        } else {
+            static std::atomic<unsigned> next_slot{0};
+            static thread_local unsigned thread_slot = next_slot.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+            return slots[thread_slot];
+        }
+    }
+
+public:
+    StatsRecorder() {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            slots.reset(new StatCounters[SLOTS]);
+        }
+    }
+
+    // function to record a lookup
+    void lookup() {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            bump(slot().lookups, 1);
+        }
+    }
+
+    // function to record buckets read by a lookup
+    void probed(unsigned buckets) {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            bump(slot().probes, buckets);
+        }
+    }
+
+    // function to record a cuckoo path that moved the given number of values
+    void relocation(size_t moved) {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            StatCounters& counters = slot();
+            bump(counters.relocations, 1);
+            bump(counters.path_histogram[moved < MAX_CUCKOO_PATH_LENGTH ? moved : MAX_CUCKOO_PATH_LENGTH - 1], 1);
+        }
+    }
+
+    // function to record a path search that found no free way
+    void failed_search() {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            bump(slot().failed_searches, 1);
+        }
+    }
+
+    // function to record a value put in the stash
+    void stashed() {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            bump(slot().stashed, 1);
+        }
+    }
+
+    // function to record a resize and how long it took
+    void resize(uint64_t ns) {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            StatCounters& counters = slot();
+            bump(counters.resizes, 1);
+            bump(counters.resize_ns, ns);
+        }
+    }
+
+    // function to record a rehash with a new seed and how long it took
+    void reseed(uint64_t ns) {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            StatCounters& counters = slot();
+            bump(counters.reseeds, 1);
+            bump(counters.resize_ns, ns);
+        }
+    }
+
+    // function to record a lock acquisition, wait_ns is only meaningful when it was contended
+    void lock_acquired(bool contended, uint64_t wait_ns) {
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            StatCounters& counters = slot();
+            bump(counters.lock_acquisitions, 1);
+            if (contended) {
+                bump(counters.contended_acquisitions, 1);
+                bump(counters.lock_wait_ns, wait_ns);
+            }
+        }
+    }
+
+    // function to add up the slots, the load factor is left to the set
+    CuckooStats snapshot() const {
+        CuckooStats stats;
+        if constexpr (CUCKOO_STATS_ENABLED) {
+            for (unsigned i = 0; i < SLOTS; i++) {
+                const StatCounters& counters = slots[i];
+                stats.lookups += read_counter(counters.lookups);
+                stats.probes += read_counter(counters.probes);
+                stats.relocations += read_counter(counters.relocations);
+                for (int length = 0; length < MAX_CUCKOO_PATH_LENGTH; length++) {
+                    stats.path_histogram[length] += read_counter(counters.path_histogram[length]);
+                }
+                stats.failed_searches += read_counter(counters.failed_searches);
+                stats.stashed += read_counter(counters.stashed);
+                stats.resizes += read_counter(counters.resizes);
+                stats.reseeds += read_counter(counters.reseeds);
+                stats.resize_ns += read_counter(counters.resize_ns);
+                stats.lock_acquisitions += read_counter(counters.lock_acquisitions);
+                stats.contended_acquisitions += read_counter(counters.contended_acquisitions);
+                stats.lock_wait_ns += read_counter(counters.lock_wait_ns);
+            }
+        }
+        return stats;
+    }
+};
@@ -1,20 +1,30 @@
 #include <stdlib.h>
+#include <unistd.h>
+#include <cstdio>
 #include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_set>
 #include <chrono>
 #include <random>
 #include <mutex>
 #include <thread>
+#include <type_traits>
 
 #include "sequential.h"
 #include "concurrent.h"
+#include "cuckoo_map.h"
+#include "cuckoo_filter.h"
 
 const int NUM_OPS = 15000000;
 const int CAPACITY = 12000;
 const int KEY_MAX = 1500;
 const int INITIAL_SIZE = KEY_MAX / 2;
 const int NUM_THREADS = 8;
+const int CHECK_OPS = 100000; // random operations of each differential check
 
 struct Operation {
     int val;
@@ -111,7 +121,415 @@ long long do_work_concurrent(CuckooConcurrentHashSet<int> *cuckoo_concurrent, st
     return std::chrono::duration_cast<std::chrono::milliseconds>(exec_time_end - exec_time_start).count();
 }
 
+// behaviour checks, run before the timings ("test --check" runs only them). each returns
+// whether everything it checked held and reports what did not
+
+// function to report a failed check, returns whether it held
+bool expect(bool held, const std::string& what) {
+    if (!held) {
+        std::cerr << "check failed: " << what << std::endl;
+    }
+    return held;
+}
+
+// function to get the path of a scratch file, unique to the process
+std::string scratch_path(const std::string& name) {
+    return "/tmp/cuckoo_" + name + "_" + std::to_string(getpid()) + ".snap";
+}
+
+// function to check that a set holds exactly the keys of a reference, all in [0, KEY_MAX]
+template <class Set>
+bool same_keys(Set& set, const std::set<int>& reference) {
+    for (int key = 0; key <= KEY_MAX; key++) {
+        if (set.contains(key) != (reference.count(key) == 1)) {
+            return false;
+        }
+    }
+    return set.size() == static_cast<int>(reference.size());
+}
+
+// function to save a set, open the image in another set and compare, write to the mapped
+// set, and check that the file still holds what was saved and that a set of another value
+// type refuses it
+template <class Set>
+bool check_set_snapshot(const std::string& name) {
+    std::string path = scratch_path(name);
+    Set saved(CAPACITY);
+    std::set<int> reference;
+    for (int key = 0; key <= KEY_MAX; key += 3) {
+        saved.add(key);
+        reference.insert(key);
+    }
+    for (int key = 0; key <= KEY_MAX; key += 9) {
+        saved.remove(key);
+        reference.erase(key);
+    }
+    bool passed = expect(saved.save(path), name + ": save");
+    Set mapped(CAPACITY);
+    passed &= expect(mapped.open_mapped(path), name + ": open_mapped")
+           && expect(same_keys(mapped, reference), name + ": contents after open_mapped");
+    std::set<int> changed = reference; // the writes land in private copies of the mapped pages
+    for (int key = 1; key <= KEY_MAX; key += 3) {
+        mapped.add(key);
+        changed.insert(key);
+    }
+    for (int key = 3; key <= KEY_MAX; key += 6) {
+        mapped.remove(key);
+        changed.erase(key);
+    }
+    passed &= expect(same_keys(mapped, changed), name + ": writes after open_mapped");
+    mapped.reserve(CAPACITY * 8); // moves the values into heap tables
+    passed &= expect(same_keys(mapped, changed), name + ": contents after leaving the mapping");
+    Set reopened(CAPACITY);
+    passed &= expect(reopened.open_mapped(path) && same_keys(reopened, reference), name + ": file left unchanged by writes");
+    Sequential<long> other(CAPACITY);
+    passed &= expect(!other.open_mapped(path), name + ": image opened by a set of long");
+    std::remove(path.c_str());
+    return passed;
+}
+
+// function to check that a map holds exactly the entries of a reference
+template <class Map, class V>
+bool same_entries(Map& map, const std::map<int, V>& reference) {
+    for (int key = 0; key <= KEY_MAX; key++) {
+        V value;
+        auto it = reference.find(key);
+        if (map.get(key, value) != (it != reference.end()) || (it != reference.end() && value != it->second)) {
+            return false;
+        }
+    }
+    return map.size() == static_cast<int>(reference.size());
+}
+
+// function to run the snapshot round trip of check_set_snapshot on a map
+bool check_map_snapshot() {
+    std::string path = scratch_path("map");
+    CuckooConcurrentHashMap<int, int> saved(CAPACITY);
+    std::map<int, int> reference;
+    for (int key = 0; key <= KEY_MAX; key += 2) {
+        saved.insert(key, key * 7);
+        reference[key] = key * 7;
+    }
+    bool passed = expect(saved.save(path), "map: save");
+    CuckooConcurrentHashMap<int, int> mapped(CAPACITY);
+    passed &= expect(mapped.open_mapped(path), "map: open_mapped")
+           && expect(same_entries(mapped, reference), "map: entries after open_mapped");
+    std::map<int, int> changed = reference;
+    for (int key = 0; key <= KEY_MAX; key += 3) {
+        mapped.insert_or_assign(key, -key);
+        changed[key] = -key;
+    }
+    passed &= expect(same_entries(mapped, changed), "map: writes after open_mapped");
+    CuckooConcurrentHashMap<int, int> reopened(CAPACITY);
+    passed &= expect(reopened.open_mapped(path) && same_entries(reopened, reference), "map: file left unchanged by writes");
+    CuckooConcurrentHashMap<int, long> other(CAPACITY);
+    passed &= expect(!other.open_mapped(path), "map: image opened by a map to long");
+    std::remove(path.c_str());
+    return passed;
+}
+
+// function to get the n-th test value of a map
+template <class V>
+V value_for(int n) {
+    if constexpr (std::is_same<V, std::string>::value) {
+        return "value " + std::to_string(n); // long enough to live on the heap
+    } else {
+        return n;
+    }
+}
+
+// function to run random inserts, assignments, upserts, erases, finds and gets on a map
+// grown from a few buckets and on a std::map, and compare every result
+template <class Map, class V>
+bool check_map_against_std(const std::string& name) {
+    Map map(16, 4); // few lock stripes, or the buckets would start at one per stripe
+    std::map<int, V> reference;
+    std::mt19937 generator(17);
+    std::uniform_int_distribution<int> keys(0, KEY_MAX);
+    std::uniform_int_distribution<int> kinds(0, 5);
+    for (int i = 0; i < CHECK_OPS; i++) {
+        int key = keys(generator);
+        V value = value_for<V>(i);
+        auto it = reference.find(key);
+        bool present = it != reference.end();
+        bool held;
+        switch (kinds(generator)) {
+            case 0:
+                held = map.insert(key, value) == !present;
+                reference.emplace(key, value);
+                break;
+            case 1:
+                held = map.insert_or_assign(key, value) == !present;
+                reference[key] = value;
+                break;
+            case 2: {
+                V updated = value_for<V>(-i);
+                held = map.upsert(key, [&updated](V& current) {
+                    current = updated;
+                }, value) == !present;
+                reference[key] = present ? updated : value;
+                break;
+            }
+            case 3:
+                held = map.erase(key) == present;
+                reference.erase(key);
+                break;
+            case 4: {
+                auto found = map.find(key);
+                held = static_cast<bool>(found) == present && (!present || *found == it->second);
+                break;
+            }
+            default: {
+                V out;
+                held = map.get(key, out) == present && (!present || out == it->second);
+                break;
+            }
+        }
+        if (!held) {
+            return expect(false, name + ": operation " + std::to_string(i) + " on key " + std::to_string(key));
+        }
+    }
+    return expect(same_entries(map, reference), name + ": entries after the operations");
+}
+
+// function to check maps with inline and boxed values against std::map
+bool check_maps() {
+    bool passed = check_map_against_std<CuckooConcurrentHashMap<int, int>, int>("inline map");
+    passed &= check_map_against_std<CuckooConcurrentHashMap<int, std::string>, std::string>("inline string map");
+    passed &= check_map_against_std<CuckooConcurrentBoxedMap<int, std::string>, std::string>("boxed map");
+    passed &= check_map_against_std<CuckooMap<int, std::string, 2, 4, DefaultHash<int>, NoLock, BoxedValue>,
+                                    std::string>("boxed map without locks");
+    return passed;
+}
+
+// function to run random contains_batch, add_batch and remove_batch calls on a set grown
+// from a few buckets, and the same keys one at a time on a twin set, comparing every
+// result. with distinct a batch never repeats a key, otherwise repeats are frequent
+template <class Set, class V>
+bool check_batches(const std::string& name, bool distinct) {
+    Set batched(16, 4); // few lock stripes, so the batches cross resizes
+    Set single(16, 4);
+    std::mt19937 generator(23);
+    std::uniform_int_distribution<int> keys(0, KEY_MAX);
+    std::uniform_int_distribution<int> sizes(1, 3 * MAX_BATCH_SIZE);
+    std::uniform_int_distribution<int> kinds(0, 2);
+    std::vector<V> batch;
+    std::unique_ptr<bool[]> out(new bool[3 * MAX_BATCH_SIZE]);
+    for (int round = 0; round < CHECK_OPS / MAX_BATCH_SIZE; round++) {
+        batched.set_batch_size(round % MAX_BATCH_SIZE + 1);
+        batch.clear();
+        std::set<int> used;
+        for (int size = sizes(generator); static_cast<int>(batch.size()) < size;) {
+            int key = distinct ? keys(generator) : keys(generator) % 64;
+            if (!distinct || used.insert(key).second) {
+                batch.push_back(value_for<V>(key));
+            }
+        }
+        int kind = kinds(generator);
+        if (kind == 0) {
+            batched.contains_batch(batch.data(), batch.size(), out.get());
+        } else if (kind == 1) {
+            batched.add_batch(batch.data(), batch.size(), out.get());
+        } else {
+            batched.remove_batch(batch.data(), batch.size(), out.get());
+        }
+        for (size_t i = 0; i < batch.size(); i++) {
+            bool expected = kind == 0 ? single.contains(batch[i]) : kind == 1 ? single.add(batch[i]) : single.remove(batch[i]);
+            if (out[i] != expected) {
+                return expect(false, name + ": round " + std::to_string(round) + ", key " + std::to_string(i) + " of the batch");
+            }
+        }
+    }
+    return expect(batched.size() == single.size(), name + ": sizes after the batches");
+}
+
+// function to check the batched operations of both kinds of set, with and without repeats
+bool check_all_batches() {
+    bool passed = true;
+    for (bool distinct : {true, false}) {
+        std::string keys = distinct ? ", distinct keys" : ", repeated keys";
+        passed &= check_batches<CuckooConcurrentHashSet<int>, int>("concurrent batches" + keys, distinct);
+        passed &= check_batches<Sequential<int>, int>("sequential batches" + keys, distinct);
+        passed &= check_batches<CuckooConcurrentHashSet<std::string>, std::string>("string batches" + keys, distinct);
+    }
+    return passed;
+}
+
+// function to fill a filter with the keys it was sized for, check that it reports every one
+// of them, and that the rate at which it reports absent keys stays below
+// false_positive_rate(), the rate of a full filter
+template <class Filter>
+bool check_filter_rate(const std::string& name) {
+    const int keys = 100000;
+    const int absent = 1000000;
+    Filter filter(keys);
+    bool passed = true;
+    for (int key = 0; key < keys; key++) {
+        passed &= filter.add(key);
+    }
+    passed = expect(passed, name + ": add within the sized capacity");
+    int missed = 0;
+    for (int key = 0; key < keys; key++) {
+        missed += !filter.contains(key);
+    }
+    passed &= expect(missed == 0, name + ": " + std::to_string(missed) + " added keys missed");
+    int false_positives = 0;
+    for (int key = keys; key < keys + absent; key++) {
+        false_positives += filter.contains(key);
+    }
+    double rate = static_cast<double>(false_positives) / absent;
+    passed &= expect(rate <= Filter::false_positive_rate(), name + ": false positive rate " + std::to_string(rate)
+                     + " above " + std::to_string(Filter::false_positive_rate()));
+    for (int key = 0; key < keys; key += 2) {
+        filter.remove(key);
+    }
+    missed = 0;
+    for (int key = 1; key < keys; key += 2) {
+        missed += !filter.contains(key);
+    }
+    passed &= expect(missed == 0 && filter.size() == keys / 2, name + ": keys kept by removes of others");
+    return passed;
+}
+
+// function to check the false positives of standalone filters
+bool check_filters() {
+    bool passed = check_filter_rate<CuckooFilter<int>>("filter");
+    passed &= check_filter_rate<CuckooFilter<int, 8>>("8-bit filter");
+    passed &= check_filter_rate<CuckooConcurrentFilter<int>>("concurrent filter");
+    return passed;
+}
+
+// function to check that a set of int holds exactly the keys of a reference, all below key_end
+template <class Set>
+bool holds_exactly(Set& set, const std::set<int>& reference, int key_end) {
+    for (int key = 0; key < key_end; key++) {
+        if (set.contains(key) != (reference.count(key) == 1)) {
+            return false;
+        }
+    }
+    return set.size() == static_cast<int>(reference.size());
+}
+
+// function to bulk load keys, each twice and some already present, first few enough to be
+// added in place and then enough to rebuild the tables on several workers, and to check
+// that reserve and shrink_to_fit keep every value
+template <class Set>
+bool check_bulk_load(const std::string& name) {
+    Set set(16, 4);
+    std::set<int> reference;
+    for (int key = 0; key < 1000; key += 2) {
+        set.add(key);
+        reference.insert(key);
+    }
+    set.reserve(2000); // room for the first load
+    bool passed = expect(holds_exactly(set, reference, 1000), name + ": contents after reserve");
+    int key_end = 0;
+    for (int distinct : {200, 200000}) {
+        std::vector<int> load;
+        size_t fresh = 0;
+        for (int key = 0; key < distinct; key++) {
+            load.push_back(key);
+            load.push_back(key);
+            fresh += reference.insert(key).second;
+        }
+        size_t added = set.bulk_load(load.begin(), load.end(), 4);
+        key_end = std::max(key_end, distinct);
+        passed &= expect(added == fresh && holds_exactly(set, reference, key_end),
+                         name + ": bulk load of " + std::to_string(distinct) + " keys, each twice");
+    }
+    set.reserve(reference.size() * 4);
+    passed &= expect(holds_exactly(set, reference, key_end), name + ": contents after a second reserve");
+    for (int key = 0; key < key_end; key++) {
+        if (key % 100 != 0) {
+            set.remove(key);
+            reference.erase(key);
+        }
+    }
+    set.shrink_to_fit();
+    passed &= expect(holds_exactly(set, reference, key_end), name + ": contents after shrink_to_fit");
+    for (int key = 1; key < key_end; key += 100) {
+        set.add(key);
+        reference.insert(key);
+    }
+    passed &= expect(holds_exactly(set, reference, key_end), name + ": adds after shrink_to_fit");
+    return passed;
+}
+
+// function to check bulk loads, reserve and shrink_to_fit on both kinds of set
+bool check_bulk_loads() {
+    bool passed = check_bulk_load<CuckooConcurrentHashSet<int>>("concurrent set");
+    passed &= check_bulk_load<Sequential<int>>("sequential set");
+    return passed;
+}
+
+// function to check emplace from constructor arguments and lookups and removes by
+// std::string_view and const char* on a set of std::string, none of which builds a string
+template <class Set>
+bool check_string_keys(const std::string& name) {
+    Set set(16, 4);
+    bool passed = expect(set.emplace(40, 'x') && set.emplace("emplaced from a pointer"), name + ": emplace");
+    passed &= expect(!set.emplace(std::string(40, 'x')) && !set.emplace("emplaced from a pointer"), name + ": emplace twice");
+    for (int i = 0; i < 1000; i++) {
+        set.add("key " + std::to_string(i));
+    }
+    int found = 0;
+    for (int i = 0; i < 1000; i++) {
+        std::string key = "key " + std::to_string(i);
+        found += set.contains(std::string_view(key)) && !set.contains(std::string_view(key).substr(1));
+    }
+    passed &= expect(found == 1000, name + ": contains by string_view");
+    passed &= expect(set.contains(std::string_view(std::string(40, 'x'))) && set.contains("emplaced from a pointer")
+                     && !set.contains("never added"), name + ": contains by const char*");
+    int removed = 0;
+    for (int i = 0; i < 1000; i += 2) {
+        std::string key = "key " + std::to_string(i);
+        removed += set.remove(std::string_view(key));
+        removed += set.remove(std::string_view(key)); // gone already
+    }
+    passed &= expect(removed == 500 && set.remove("emplaced from a pointer") && set.size() == 501,
+                     name + ": remove by string_view and const char*");
+    int kept = 0;
+    for (int i = 0; i < 1000; i++) {
+        kept += set.contains(std::string_view("key " + std::to_string(i))) == (i % 2 == 1);
+    }
+    passed &= expect(kept == 1000, name + ": contents after the removes");
+    return passed;
+}
+
+// function to check string keys on both kinds of set
+bool check_all_string_keys() {
+    bool passed = check_string_keys<CuckooConcurrentHashSet<std::string>>("concurrent string set");
+    passed &= check_string_keys<Sequential<std::string>>("sequential string set");
+    return passed;
+}
+
+// function to check save and open_mapped on both kinds of set and on a map
+bool check_snapshots() {
+    bool passed = check_set_snapshot<CuckooConcurrentHashSet<int>>("concurrent_set");
+    passed &= check_set_snapshot<Sequential<int>>("sequential_set");
+    passed &= check_map_snapshot();
+    return passed;
+}
+
+// function to run every behaviour check
+bool run_checks() {
+    bool passed = check_snapshots();
+    passed &= check_maps();
+    passed &= check_filters();
+    passed &= check_all_batches();
+    passed &= check_bulk_loads();
+    passed &= check_all_string_keys();
+    return passed;
+}
+
 int main(int argc, char *argv[]) {
+    if (!run_checks()) {
+        return 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        std::cout << "All checks passed" << std::endl;
+        return 0;
+    }
     Sequential<int> *cuckoo_sequential = new Sequential<int>(CAPACITY);
     auto sequential_operations = generate_entries(INITIAL_SIZE);
     if (!cuckoo_sequential->populate(sequential_operations))
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <unordered_set>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+
+#include "transactional.h"
+
+const int NUM_OPS = 1000000;
+const int CAPACITY = 12000;
+const int KEY_MAX = 1500;
+const int INITIAL_SIZE = KEY_MAX / 2;
+const int NUM_THREADS = 8;
+const unsigned ABORT_LIMIT = 8; // aborts before an operation falls back to the global lock
+
+std::vector<int> generate_entries(int num_entries) {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> entry_generator(0, KEY_MAX);
+
+    std::unordered_set<int> entries;
+    while (entries.size() < static_cast<size_t>(num_entries)) {
+        entries.insert(entry_generator(generator));
+    }
+    return {entries.begin(), entries.end()};
+}
+
+// 80% contains, 10% add, 10% remove; returns the net change of the set size
+long long transactional_workload(TransactionalCuckooSet<int> *cuckoo_transactional, int thread_id) {
+    std::mt19937 generator(thread_id);
+    std::uniform_int_distribution<int> distribution_percentage(1, 100);
+    std::uniform_int_distribution<int> distribution_entries(0, KEY_MAX);
+    volatile long long delta = 0; // volatile, live across the setjmp-like start of each transaction
+    for (int i = 0; i < NUM_OPS; i++) {
+        int which_op = distribution_percentage(generator);
+        int val = distribution_entries(generator);
+        if (which_op <= 80) {
+            cuckoo_transactional->contains(val); //contains operation
+        } else if (which_op <= 90) {
+            delta += cuckoo_transactional->add(val); //add operation
+        } else {
+            delta -= cuckoo_transactional->remove(val); //remove operation
+        }
+    }
+    return delta;
+}
+
+void print_stats(const char *name, TransactionStats stats) {
+    std::cout << name << "\tcommits: " << stats.commits << "\taborts: " << stats.aborts
+              << "\tfallbacks: " << stats.fallbacks << std::endl;
+}
+
+int main() {
+    for (unsigned abort_limit : {0u, ABORT_LIMIT}) {
+        TransactionalCuckooSet<int> *cuckoo_transactional = new TransactionalCuckooSet<int>(CAPACITY, abort_limit);
+        auto entries = generate_entries(INITIAL_SIZE);
+        if (!cuckoo_transactional->populate(entries))
+            return 1;
+
+        std::atomic<long long> expected_size(entries.size());
+        std::vector<std::thread> threads;
+        auto exec_time_start = std::chrono::high_resolution_clock::now();
+        for (int thread = 0; thread < NUM_THREADS; thread++) {
+            threads.emplace_back([&, thread] {
+                expected_size += transactional_workload(cuckoo_transactional, thread);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto exec_time_end = std::chrono::high_resolution_clock::now();
+        long long exec_time = std::chrono::duration_cast<std::chrono::milliseconds>(exec_time_end - exec_time_start).count();
+
+        std::cout << "Transactional time (milliseconds), abort limit " << abort_limit << ":\t" << exec_time << std::endl;
+        print_stats("contains", cuckoo_transactional->contains_stats());
+        print_stats("add", cuckoo_transactional->add_stats());
+        print_stats("remove", cuckoo_transactional->remove_stats());
+        if (cuckoo_transactional->size() != expected_size) {
+            std::cout << "size mismatch: " << cuckoo_transactional->size() << " != " << expected_size << std::endl;
+            return 1;
+        }
+        delete cuckoo_transactional;
+    }
+    return 0;
+}
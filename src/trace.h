@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "aligned_allocator.h"
+#include "hash_policy.h"
+#include "snapshot.h"
+
+// binary workload traces, written by trace_gen or recorded with TraceWriter and replayed by
+// bench --trace. a trace is a header, a directory of sections, then the sections: the keys
+// to preload before timing, then one operation stream per thread. a record is 4 bytes, the
+// operation in the top 2 bits and the key in the other 30, so 120M operations take 480MB
+// and are replayed straight from the mapping. a trace recorded from one thread is a single
+// stream, which the replay splits between its threads
+
+enum TraceOp : uint32_t { TRACE_CONTAINS = 0, TRACE_ADD = 1, TRACE_REMOVE = 2 };
+
+constexpr uint64_t TRACE_MAGIC = 0x3143525455434B43ull; // "CKUCTRC1" read as little endian
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr int TRACE_KEY_BITS = 30;
+constexpr uint32_t TRACE_KEY_MASK = (1u << TRACE_KEY_BITS) - 1;
+
+struct TraceHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t streams;      // operation streams, the preloaded keys come first
+    uint32_t record_size;
+    uint64_t seed;         // of the generator, 0 for a recorded trace
+};
+
+// records of one section, offset in bytes from the start of the file
+struct TraceSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+inline uint32_t trace_record(TraceOp op, uint32_t key) {
+    return static_cast<uint32_t>(op) << TRACE_KEY_BITS | (key & TRACE_KEY_MASK);
+}
+
+inline TraceOp trace_op(uint32_t record) {
+    return static_cast<TraceOp>(record >> TRACE_KEY_BITS);
+}
+
+inline uint32_t trace_key(uint32_t record) {
+    return record & TRACE_KEY_MASK;
+}
+
+// writer of a trace with a given number of streams, for recording real operations or for
+// trace_gen. each stream is buffered in a temporary file of its own and belongs to one
+// thread at a time, so recording takes no lock; finish
+// gathers the streams behind the header and renames the result over path, like
+// write_snapshot. keys of 30 bits or more are folded through mix64, so a recorded key
+// always maps to the same trace key and the access pattern survives
+class TraceWriter {
+    // a section being recorded, on a cache line of its own so recording threads do not meet
+    struct alignas(CACHE_LINE_SIZE) Part {
+        std::FILE* file = nullptr;
+        uint64_t count = 0;
+        bool failed = false;
+    };
+
+    std::string path;
+    uint64_t seed;
+    std::vector<Part> parts; // the preloaded keys, then the streams
+
+    std::string part_path(size_t section) const {
+        return path + ".part" + std::to_string(section);
+    }
+
+    void append(size_t section, uint32_t record) {
+        Part& part = parts[section];
+        part.failed = part.failed || std::fwrite(&record, sizeof(record), 1, part.file) != 1;
+        part.count++;
+    }
+
+    static uint32_t fold(uint64_t key) {
+        return key <= TRACE_KEY_MASK ? static_cast<uint32_t>(key)
+                                     : static_cast<uint32_t>(mix64(key, 0)) & TRACE_KEY_MASK;
+    }
+
+    void remove_parts() {
+        for (size_t section = 0; section < parts.size(); section++) {
+            if (parts[section].file != nullptr) {
+                std::fclose(parts[section].file);
+                parts[section].file = nullptr;
+            }
+            std::remove(part_path(section).c_str());
+        }
+    }
+
+public:
+    TraceWriter(const std::string& path, int streams, uint64_t seed = 0)
+            : path(path), seed(seed), parts(streams + 1) {
+        for (size_t section = 0; section < parts.size(); section++) {
+            parts[section].file = std::fopen(part_path(section).c_str(), "w+b");
+            parts[section].failed = parts[section].file == nullptr;
+        }
+    }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // destructor, a trace that was not finished is dropped
+    ~TraceWriter() {
+        remove_parts();
+    }
+
+    // function to add a key to insert before the operations are replayed
+    void preload(uint64_t key) {
+        append(0, trace_record(TRACE_ADD, fold(key)));
+    }
+
+    // function to append an operation to a stream
+    void record(int stream, TraceOp op, uint64_t key) {
+        append(stream + 1, trace_record(op, fold(key)));
+    }
+
+    // function to write the trace to path once every recording thread is done, false if any
+    // step failed
+    bool finish() {
+        TraceHeader header = {};
+        header.magic = TRACE_MAGIC;
+        header.version = TRACE_VERSION;
+        header.header_size = sizeof(TraceHeader);
+        header.streams = static_cast<uint32_t>(parts.size() - 1);
+        header.record_size = sizeof(uint32_t);
+        header.seed = seed;
+        std::vector<TraceSection> sections(parts.size());
+        uint64_t offset = sizeof(TraceHeader) + sections.size() * sizeof(TraceSection);
+        bool recorded = true;
+        for (size_t section = 0; section < parts.size(); section++) {
+            sections[section] = TraceSection{offset, parts[section].count};
+            offset += parts[section].count * sizeof(uint32_t);
+            recorded = recorded && !parts[section].failed;
+        }
+        std::string temporary = path + ".tmp";
+        std::FILE* out = recorded ? std::fopen(temporary.c_str(), "wb") : nullptr;
+        bool written = out != nullptr && std::fwrite(&header, sizeof(header), 1, out) == 1
+                    && std::fwrite(sections.data(), sizeof(TraceSection), sections.size(), out) == sections.size();
+        std::vector<char> buffer(1 << 16);
+        for (size_t section = 0; written && section < parts.size(); section++) {
+            std::rewind(parts[section].file);
+            size_t read;
+            while (written && (read = std::fread(buffer.data(), 1, buffer.size(), parts[section].file)) > 0) {
+                written = std::fwrite(buffer.data(), 1, read, out) == read;
+            }
+        }
+        if (out != nullptr) {
+            written = written && std::fflush(out) == 0 && fsync(fileno(out)) == 0;
+            written = std::fclose(out) == 0 && written;
+        }
+        remove_parts();
+        if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+// trace mapped for replay: the records are read in place from the mapping, nothing is copied
+class TraceFile {
+    MappedFile mapping;
+    const TraceHeader* header = nullptr;
+    const TraceSection* sections = nullptr;
+
+    const uint32_t* records(size_t section) const {
+        return reinterpret_cast<const uint32_t*>(mapping.data() + sections[section].offset);
+    }
+
+public:
+    // function to map a trace, false if it cannot be mapped or is not a whole trace. every
+    // record is read once to check its operation, which also faults the mapping in before
+    // the replay is timed
+    bool open(const std::string& path) {
+        if (!mapping.map(path) || mapping.size() < sizeof(TraceHeader)) {
+            return false;
+        }
+        const TraceHeader* mapped = reinterpret_cast<const TraceHeader*>(mapping.data());
+        size_t directory = sizeof(TraceHeader) + (static_cast<size_t>(mapped->streams) + 1) * sizeof(TraceSection);
+        if (mapped->magic != TRACE_MAGIC || mapped->version != TRACE_VERSION
+                || mapped->header_size != sizeof(TraceHeader) || mapped->record_size != sizeof(uint32_t)
+                || mapped->streams == 0 || directory > mapping.size()) {
+            return false;
+        }
+        const TraceSection* directory_start = reinterpret_cast<const TraceSection*>(mapping.data() + sizeof(TraceHeader));
+        for (size_t section = 0; section <= mapped->streams; section++) {
+            const TraceSection& checked = directory_start[section];
+            if (checked.offset < directory || checked.offset > mapping.size() || checked.offset % sizeof(uint32_t) != 0
+                    || checked.count > (mapping.size() - checked.offset) / sizeof(uint32_t)) {
+                return false;
+            }
+        }
+        madvise(mapping.data(), mapping.size(), MADV_SEQUENTIAL); // the streams are read front to back
+        header = mapped;
+        sections = directory_start;
+        for (size_t section = 0; section <= mapped->streams; section++) {
+            const uint32_t* checked = records(section);
+            for (size_t i = 0; i < sections[section].count; i++) {
+                TraceOp op = trace_op(checked[i]);
+                if (section == 0 ? op != TRACE_ADD : op > TRACE_REMOVE) { // preloaded keys are adds
+                    header = nullptr;
+                    sections = nullptr;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    int streams() const {
+        return header->streams;
+    }
+
+    uint64_t seed() const {
+        return header->seed;
+    }
+
+    // function to get the keys to preload
+    const uint32_t* preload() const {
+        return records(0);
+    }
+
+    size_t preload_size() const {
+        return sections[0].count;
+    }
+
+    // function to get the records of a stream
+    const uint32_t* stream(int index) const {
+        return records(index + 1);
+    }
+
+    size_t stream_size(int index) const {
+        return sections[index + 1].count;
+    }
+};
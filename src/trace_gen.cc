@@ -0,0 +1,84 @@
+#include <climits>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+#include "workload.h"
+
+// trace generator: writes the workload bench would generate for the same options to a trace
+// file (see trace.h), one stream per thread, for bench --trace to replay. the generator is
+// seeded, so a trace is reproduced exactly by running it again with the same options
+
+struct Options : Workload {
+    int threads = 1; // streams of the trace
+    std::string out;
+};
+
+void usage() {
+    std::cout << "usage: trace_gen --out FILE [options]\n"
+              << "  --out FILE          trace to write\n"
+              << "  --threads N         operation streams, one per replaying thread (default 1)\n"
+              << WORKLOAD_USAGE;
+}
+
+bool parse_args(int argc, char *argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool valid = true;
+        int value_at = i + 1; // the value of arg, if it takes one
+        try {
+            if (arg == "--help" || arg == "-h") {
+                return false;
+            } else if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << std::endl;
+                return false;
+            } else if (parse_workload_option(arg, argv[i + 1], options, valid)) {
+                i++;
+            } else if (arg == "--threads") {
+                options.threads = static_cast<int>(parse_integer(argv[++i], INT_MIN, INT_MAX));
+            } else if (arg == "--out") {
+                options.out = argv[++i];
+            } else {
+                std::cerr << "unknown option " << arg << std::endl;
+                return false;
+            }
+        } catch (const std::logic_error&) { // std::invalid_argument or std::out_of_range
+            std::cerr << "invalid value " << argv[value_at] << " for " << arg << std::endl;
+            return false;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    if (options.out.empty() || options.threads < 1) {
+        std::cerr << "a trace needs --out and at least one thread" << std::endl;
+        return false;
+    }
+    return finish_workload(options);
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        usage();
+        return 1;
+    }
+    TraceWriter writer(options.out, options.threads, options.seed);
+    for (int key : generate_entries(options)) {
+        writer.preload(key);
+    }
+    for (int thread = 0; thread < options.threads; thread++) {
+        generate_operations(options, thread, [&writer, thread](uint32_t record) {
+            writer.record(thread, trace_op(record), trace_key(record));
+        });
+    }
+    if (!writer.finish()) {
+        std::cerr << "cannot write trace " << options.out << std::endl;
+        return 1;
+    }
+    std::cout << "wrote " << options.ops * options.threads << " operations in " << options.threads
+              << " streams to " << options.out << std::endl;
+    return 0;
+}
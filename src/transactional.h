@@ -0,0 +1,191 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+
+#include "aligned_allocator.h"
+#include "sequential.h"
+
+// needs to be compiled with -fgnu-tm and linked with -litm (see the tm_test target of the Makefile).
+// libitm runs the transactions in software, no hardware transactional memory is required
+
+// outcome counters of one kind of operation
+struct TransactionStats {
+    uint64_t commits = 0;   // operations whose transaction committed
+    uint64_t aborts = 0;    // attempts rolled back by a conflict and retried
+    uint64_t fallbacks = 0; // operations that ran under the global lock instead
+};
+
+// function to count an attempt of a transaction. transaction_pure keeps the increment out of
+// the transaction log, so it survives the rollback of the attempt
+__attribute__((transaction_pure)) inline unsigned count_attempt(unsigned& attempts) {
+    return ++attempts;
+}
+
+// function that cannot run speculatively. calling it inside a relaxed transaction switches
+// libitm to serial irrevocable mode, which waits for every other transaction to finish and
+// keeps new ones out until it commits: libitm's global lock
+__attribute__((noinline)) inline void become_irrevocable() {
+    asm volatile("");
+}
+
+// the sequential set made concurrent by running each operation as a GCC transaction.
+// add runs atomically as long as a candidate bucket has a free way; displacing values and
+// growing the table allocate, which atomic transactions cannot do, so those inserts run
+// under the global lock. with a nonzero abort limit an operation also gives up on the
+// transaction after that many aborts and runs under the global lock (lock elision)
+template <class T>
+class TransactionalCuckooSet {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "copies of the values are instrumented by the transactions and must not allocate");
+
+    enum Op { CONTAINS, ADD, REMOVE, OPS };
+
+    // counters are spread over padded slots picked per thread, so they do not add a shared
+    // cache line to every transaction
+    static constexpr unsigned STAT_SLOTS = 64;
+
+    struct alignas(CACHE_LINE_SIZE) StatSlot {
+        std::atomic<uint64_t> commits[OPS] = {};
+        std::atomic<uint64_t> aborts[OPS] = {};
+        std::atomic<uint64_t> fallbacks[OPS] = {};
+    };
+
+    Sequential<T> set;
+    unsigned abort_limit; // 0 => retry the transaction until it commits
+    std::unique_ptr<StatSlot[]> stat_slots;
+
+    // function to get the counter slot of the calling thread
+    static unsigned thread_slot() {
+        static std::atomic<unsigned> next_slot{0};
+        static thread_local unsigned slot = next_slot.fetch_add(1, std::memory_order_relaxed) % STAT_SLOTS;
+        return slot;
+    }
+
+    // function to record the outcome of one operation
+    void record(Op op, unsigned attempts, bool fell_back) {
+        StatSlot& slot = stat_slots[thread_slot()];
+        if (fell_back) {
+            slot.fallbacks[op].fetch_add(1, std::memory_order_relaxed);
+        } else {
+            slot.commits[op].fetch_add(1, std::memory_order_relaxed);
+        }
+        if (attempts > 1) {
+            slot.aborts[op].fetch_add(attempts - 1, std::memory_order_relaxed);
+        }
+    }
+
+    // function to add up the counters of one kind of operation
+    TransactionStats total(Op op) const {
+        TransactionStats stats;
+        for (unsigned i = 0; i < STAT_SLOTS; i++) {
+            stats.commits += stat_slots[i].commits[op].load(std::memory_order_relaxed);
+            stats.aborts += stat_slots[i].aborts[op].load(std::memory_order_relaxed);
+            stats.fallbacks += stat_slots[i].fallbacks[op].load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+public:
+    // constructor, abort_limit is the number of aborts after which an operation falls back to
+    // the global lock, 0 to never fall back
+    TransactionalCuckooSet(int initial_capacity, unsigned abort_limit = 0)
+            : set(initial_capacity), abort_limit(abort_limit), stat_slots(new StatSlot[STAT_SLOTS]) {}
+
+    // function to add a value to the set
+    bool add(const T& val) {
+        unsigned attempts = 0;
+        bool committed = false;
+        typename Sequential<T>::InPlace outcome = Sequential<T>::InPlace::FULL;
+        __transaction_atomic {
+            unsigned attempt = count_attempt(attempts);
+            if (abort_limit != 0 && attempt > abort_limit) {
+                __transaction_cancel;
+            }
+            outcome = set.add_in_place(val);
+            committed = true;
+        }
+        if (committed && outcome != Sequential<T>::InPlace::FULL) {
+            record(ADD, attempts, false);
+            return outcome == Sequential<T>::InPlace::ADDED;
+        }
+        bool added;
+        __transaction_relaxed {
+            become_irrevocable();
+            added = set.add(val); // displaces values or grows the table
+        }
+        record(ADD, attempts, true);
+        return added;
+    }
+
+    // function to remove a value from the set
+    bool remove(const T& val) {
+        unsigned attempts = 0;
+        bool committed = false;
+        bool removed = false;
+        __transaction_atomic {
+            unsigned attempt = count_attempt(attempts);
+            if (abort_limit != 0 && attempt > abort_limit) {
+                __transaction_cancel;
+            }
+            removed = set.remove(val);
+            committed = true;
+        }
+        if (!committed) {
+            __transaction_relaxed {
+                become_irrevocable();
+                removed = set.remove(val);
+            }
+        }
+        record(REMOVE, attempts, !committed);
+        return removed;
+    }
+
+    // function to check if a value is in the set
+    bool contains(const T& val) {
+        unsigned attempts = 0;
+        bool committed = false;
+        bool found = false;
+        __transaction_atomic {
+            unsigned attempt = count_attempt(attempts);
+            if (abort_limit != 0 && attempt > abort_limit) {
+                __transaction_cancel;
+            }
+            found = set.contains(val);
+            committed = true;
+        }
+        if (!committed) {
+            __transaction_relaxed {
+                become_irrevocable();
+                found = set.contains(val);
+            }
+        }
+        record(CONTAINS, attempts, !committed);
+        return found;
+    }
+
+    // function to get the number of elements in the set, not thread safe
+    int size() {
+        return set.size();
+    }
+
+    // function to populate the set with a list of entries, not thread safe
+    bool populate(const std::vector<T>& entries) {
+        return set.populate(entries);
+    }
+
+    // function to read the hot-path counters of the wrapped set, all zero unless CUCKOO_STATS
+    // is defined. they are plain counters bumped inside the transactions, so turning them on
+    // makes every transaction conflict on them; not thread safe
+    CuckooStats stats() {
+        return set.stats();
+    }
+
+    // functions to read the transaction outcomes recorded so far
+    TransactionStats contains_stats() const { return total(CONTAINS); }
+    TransactionStats add_stats() const { return total(ADD); }
+    TransactionStats remove_stats() const { return total(REMOVE); }
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "trace.h"
+
+// synthetic workloads of the benchmark driver and of trace_gen: keys to preload, then for
+// each thread a stream of operations drawn from a seeded generator, so the same options
+// always produce the same operations
+
+struct Workload {
+    long long ops = 1000000;          // operations per thread
+    int key_max = 1500;               // keys are drawn from [0, key_max]
+    int initial = -1;                 // keys inserted before timing, key_max / 2 by default
+    int contains_pct = 80;
+    int add_pct = 10;                 // the rest of the mix is remove
+    std::string distribution = "uniform"; // uniform or zipf
+    double zipf_theta = 0.99;
+    unsigned seed = 1;
+};
+
+// options of a workload, for the usage text of the tools that take them
+constexpr const char* WORKLOAD_USAGE =
+        "  --ops N             operations per thread (default 1000000)\n"
+        "  --key-max N         keys are drawn from [0, N] (default 1500)\n"
+        "  --initial N         keys inserted before timing (default key-max / 2)\n"
+        "  --mix C,A,R         percent of contains, add, remove (default 80,10,10)\n"
+        "  --dist NAME         uniform or zipf (default uniform)\n"
+        "  --theta X           zipf skew, between 0 and 1 (default 0.99)\n"
+        "  --seed N            seed of the workload generator (default 1)\n";
+
+// function to read an integer in [low, high] that makes up the whole of text. like
+// std::stoll it throws std::invalid_argument, or std::out_of_range past the bounds
+inline long long parse_integer(const std::string& text, long long low = LLONG_MIN, long long high = LLONG_MAX) {
+    size_t used;
+    long long value = std::stoll(text, &used);
+    if (used != text.size()) {
+        throw std::invalid_argument(text);
+    }
+    if (value < low || value > high) {
+        throw std::out_of_range(text);
+    }
+    return value;
+}
+
+// function to read a number that makes up the whole of text, throws like std::stod
+inline double parse_real(const std::string& text) {
+    size_t used;
+    double value = std::stod(text, &used);
+    if (used != text.size()) {
+        throw std::invalid_argument(text);
+    }
+    return value;
+}
+
+inline std::vector<int> parse_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(static_cast<int>(parse_integer(item, INT_MIN, INT_MAX)));
+    }
+    return values;
+}
+
+// function to apply arg if it is a workload option, false if it is not one. valid is
+// cleared when its value is out of range; a value that is not a number throws as in
+// parse_integer, for the caller to report
+inline bool parse_workload_option(const std::string& arg, const std::string& value, Workload& workload, bool& valid) {
+    if (arg == "--ops") {
+        workload.ops = parse_integer(value);
+        if (workload.ops < 1) {
+            std::cerr << "--ops needs at least one operation" << std::endl;
+            valid = false;
+        }
+    } else if (arg == "--key-max") {
+        workload.key_max = static_cast<int>(parse_integer(value, INT_MIN, INT_MAX));
+        if (workload.key_max < 0) {
+            std::cerr << "--key-max cannot be negative" << std::endl;
+            valid = false;
+        }
+    } else if (arg == "--initial") {
+        workload.initial = static_cast<int>(parse_integer(value, INT_MIN, INT_MAX));
+        if (workload.initial < 0) {
+            std::cerr << "--initial cannot be negative" << std::endl;
+            valid = false;
+        }
+    } else if (arg == "--mix") {
+        std::vector<int> mix = parse_list(value);
+        bool percentages = mix.size() == 3 && std::all_of(mix.begin(), mix.end(), [](int pct) {
+            return pct >= 0 && pct <= 100;
+        });
+        if (!percentages || mix[0] + mix[1] + mix[2] != 100) {
+            std::cerr << "--mix needs three percentages from 0 to 100 that add up to 100" << std::endl;
+            valid = false;
+            return true;
+        }
+        workload.contains_pct = mix[0];
+        workload.add_pct = mix[1];
+    } else if (arg == "--dist") {
+        workload.distribution = value;
+    } else if (arg == "--theta") {
+        workload.zipf_theta = parse_real(value);
+        if (!(workload.zipf_theta > 0 && workload.zipf_theta < 1)) {
+            std::cerr << "--theta needs a skew between 0 and 1, both excluded" << std::endl;
+            valid = false;
+        }
+    } else if (arg == "--seed") {
+        workload.seed = static_cast<unsigned>(parse_integer(value, 0, UINT_MAX));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// function to fill in the defaults of a workload once its options are parsed and check it
+inline bool finish_workload(Workload& workload) {
+    if (workload.initial < 0) {
+        workload.initial = workload.key_max / 2;
+    }
+    if (workload.initial > workload.key_max + 1) {
+        std::cerr << "--initial cannot exceed the number of distinct keys" << std::endl;
+        return false;
+    }
+    if (static_cast<uint32_t>(workload.key_max) > TRACE_KEY_MASK) {
+        std::cerr << "--key-max cannot exceed " << TRACE_KEY_MASK << std::endl;
+        return false;
+    }
+    if (workload.distribution != "uniform" && workload.distribution != "zipf") {
+        std::cerr << "unknown distribution " << workload.distribution << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// zipfian keys over [0, n) (Gray et al., "Quickly generating billion-record synthetic
+// databases"), popular ranks are scattered over the key range so hot keys do not share buckets
+class ZipfGenerator {
+    long long n;
+    double theta, alpha, zetan, eta;
+
+public:
+    ZipfGenerator(long long n, double theta) : n(n), theta(theta) {
+        double zeta2 = 0;
+        zetan = 0;
+        for (long long i = 1; i <= n; i++) {
+            zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+            if (i == 2) {
+                zeta2 = zetan;
+            }
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    template <class Generator>
+    long long operator()(Generator& generator) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+        double uz = u * zetan;
+        long long rank;
+        if (uz < 1.0) {
+            rank = 0;
+        } else if (uz < 1.0 + std::pow(0.5, theta)) {
+            rank = 1;
+        } else {
+            rank = static_cast<long long>(n * std::pow(eta * u - eta + 1.0, alpha));
+        }
+        rank = std::min(rank, n - 1);
+        return static_cast<long long>((static_cast<unsigned long long>(rank) * 0x9E3779B97F4A7C15ull) % n);
+    }
+};
+
+// function to draw the distinct keys inserted before timing
+inline std::vector<int> generate_entries(const Workload& workload) {
+    std::mt19937 generator(workload.seed);
+    std::uniform_int_distribution<int> entry_generator(0, workload.key_max);
+    std::unordered_set<int> entries;
+    while (static_cast<int>(entries.size()) < workload.initial) {
+        entries.insert(entry_generator(generator));
+    }
+    return {entries.begin(), entries.end()};
+}
+
+// function to generate the operations of one thread as trace records, calling
+// emit(record) for each in order
+template <class F>
+void generate_operations(const Workload& workload, int thread_id, F&& emit) {
+    std::mt19937_64 generator(workload.seed * 1000003ull + thread_id + 1);
+    std::uniform_int_distribution<int> distribution_percentage(1, 100);
+    std::uniform_int_distribution<int> distribution_uniform(0, workload.key_max);
+    std::unique_ptr<ZipfGenerator> zipf;
+    if (workload.distribution == "zipf") {
+        zipf.reset(new ZipfGenerator(static_cast<long long>(workload.key_max) + 1, workload.zipf_theta));
+    }
+    for (long long i = 0; i < workload.ops; i++) {
+        int which_op = distribution_percentage(generator);
+        TraceOp op = which_op <= workload.contains_pct ? TRACE_CONTAINS
+                   : which_op <= workload.contains_pct + workload.add_pct ? TRACE_ADD : TRACE_REMOVE;
+        int key = zipf ? static_cast<int>((*zipf)(generator)) : distribution_uniform(generator);
+        emit(trace_record(op, key));
+    }
+}